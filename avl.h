@@ -6,39 +6,391 @@
 #pragma once
 
 #include <iostream> // print_tree and size_t
-#include <cstddef> // size_t
+#include <cstddef> // size_t, ptrdiff_t
+#include <iterator> // std::bidirectional_iterator_tag, std::reverse_iterator
 #include <stdexcept> // std::invalid_argument
-
+#include <utility> // std::move, std::pair
+#include <vector> // retired nodes
+#include <memory> // std::unique_ptr, std::allocator
+#include <new> // placement new, std::launder
+#include <functional> // std::less
+#include <atomic> // reader epochs
+#include <thread> // std::this_thread::yield
+#include <cstdint> // uint64_t
+#include <optional> // last value seen by a cursor
+#include <cmath> // std::ceil
+#include <random> // std::uniform_int_distribution
+#include <unordered_set> // sampled positions
+#include <algorithm> // std::sort
+#include <mutex> // first error of a parallel walk
+#include <exception> // std::exception_ptr
+#include <type_traits> // std::is_copy_constructible_v
+#include <system_error> // thread creation failures
+#if __cplusplus >= 202002L
+#include <span> // cursor batches
+#endif
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine> // interleaved lookups
+#define AVL_HAS_COROUTINES 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define AVL_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define AVL_PREFETCH(address) ((void) (address))
+#endif
+
+// Extra data kept in every node and recomputed from the node's value and children
+// whenever they change, including through rotations. Specialize it for a value type
+// to build augmented trees on top of AVLTree (see interval_tree.h).
 template <typename Comparable>
-class AVLTree {
+struct AVLAugment {
+    struct data {};
+
+    template <typename Node>
+    static void update(Node*) noexcept {}
+};
+
+// Balance policies, the second template parameter of AVLTree.
+// Strict AVL: sibling subtrees differ in height by at most one.
+struct AVLStrict {
+    static constexpr int slack = 1;
+    static constexpr bool rank_balanced = false;
+};
+
+// Relaxed AVL (HB[k]): sibling heights may differ by up to Slack, so fewer updates rotate
+// at the cost of taller trees (about Slack / 2 + 1.44 log n). rebalance_all can restore a
+// perfect balance in one batch when the write-heavy phase is over.
+template <int Slack = 2>
+struct AVLRelaxed {
+    static_assert(Slack >= 1, "Slack must be at least 1");
+    static constexpr int slack = Slack;
+    static constexpr bool rank_balanced = false;
+};
+
+// Rank balanced (weak AVL, WAVL): every node has a rank, rank differences to children are
+// 1 or 2 and leaves have rank 0. At most two rotations per insert or remove and O(1)
+// amortized rank changes; built by inserts alone it has the same shape as strict AVL.
+struct AVLRankBalanced {
+    static constexpr int slack = 0;
+    static constexpr bool rank_balanced = true;
+};
+
+#ifdef AVL_HAS_COROUTINES
+// A lookup that prefetches each node before touching it and suspends in between, so an
+// AVLScheduler can interleave many lookups (across any trees) and overlap their cache misses.
+template <typename T>
+class AVLLookup {
+    public:
+        struct promise_type {
+            T result{};
+
+            AVLLookup get_return_object() { return AVLLookup(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; } // started by the scheduler
+            std::suspend_always final_suspend() noexcept { return {}; } // keeps the result until destroyed
+            void return_value(T value) { result = std::move(value); }
+            void unhandled_exception() { throw; }
+        };
+
+    private:
+        std::coroutine_handle<promise_type> coroutine;
+
+        explicit AVLLookup(std::coroutine_handle<promise_type> coroutine) : coroutine{coroutine} {}
+
+    public:
+        AVLLookup(AVLLookup&& other) noexcept : coroutine{other.coroutine} { other.coroutine = nullptr; }
+        AVLLookup& operator=(AVLLookup&&) = delete;
+        AVLLookup(const AVLLookup&) = delete;
+        AVLLookup& operator=(const AVLLookup&) = delete;
+        ~AVLLookup() { if (coroutine) coroutine.destroy(); }
+
+        std::coroutine_handle<> handle() const noexcept { return coroutine; }
+        bool done() const noexcept { return coroutine.done(); }
+        void resume() { coroutine.resume(); }
+        const T& result() const { return coroutine.promise().result; }
+
+        // runs the lookup to completion on its own
+        const T& get() {
+            while (!coroutine.done()) coroutine.resume();
+            return result();
+        }
+};
+
+// issues a prefetch for address and suspends, the lookup continues once the scheduler comes back to it
+struct AVLPrefetch {
+    const void* address;
+
+    bool await_ready() const noexcept { return !address; }
+    void await_suspend(std::coroutine_handle<>) const noexcept { AVL_PREFETCH(address); }
+    void await_resume() const noexcept {}
+};
+
+// resumes up to width lookups round robin until every added lookup has finished
+class AVLScheduler {
     private:
-        struct AVLNode {
+        size_t width;
+        std::vector<std::coroutine_handle<>> queued;
+
+    public:
+        explicit AVLScheduler(size_t width) : width{width ? width : 1}, queued{} {}
+
+        template <typename T>
+        void add(AVLLookup<T>& lookup) { queued.push_back(lookup.handle()); }
+
+        void run() {
+            std::vector<std::coroutine_handle<>> active;
+            size_t next = 0;
+            while (next < queued.size() && active.size() < width) active.push_back(queued[next++]);
+
+            while (!active.empty()) {
+                for (size_t i = 0; i < active.size();) {
+                    active[i].resume();
+                    if (!active[i].done()) i++;
+                    else if (next < queued.size()) active[i++] = queued[next++];
+                    else {
+                        active[i] = active.back();
+                        active.pop_back();
+                    }
+                }
+            }
+            queued.clear();
+        }
+};
+#endif
+
+template <typename Comparable, typename Balance = AVLStrict>
+class AVLTree {
+    protected: // for trees that build on AVLTree
+        struct AVLNode : AVLAugment<Comparable>::data {
             Comparable value;
             AVLNode* left;
             AVLNode* right;
-            int height;
+            int height; // rank + 1 under AVLRankBalanced
             AVLNode* parent; // for iterator
+            size_t count; // nodes in this subtree, for order statistics
 
-            AVLNode() : value{}, left{nullptr}, right{nullptr}, height{1}, parent{nullptr} {}
-            explicit AVLNode(const Comparable& value) : value{value}, left{nullptr}, right{nullptr}, height{1}, parent{nullptr} {}
-            AVLNode(const Comparable& value, AVLNode* parent) : value{value}, left{nullptr}, right{nullptr}, height{1}, parent{parent} {}
+            AVLNode() : value{}, left{nullptr}, right{nullptr}, height{1}, parent{nullptr}, count{1} {}
+            explicit AVLNode(const Comparable& value) : value{value}, left{nullptr}, right{nullptr}, height{1}, parent{nullptr}, count{1} {}
+            AVLNode(const Comparable& value, AVLNode* parent) : value{value}, left{nullptr}, right{nullptr}, height{1}, parent{parent}, count{1} {}
             AVLNode(const Comparable& value, AVLNode* left, AVLNode* right, int height, AVLNode* parent) 
-                : value{value}, left{left}, right{right}, height{height}, parent{parent} {}
+                : value{value}, left{left}, right{right}, height{height}, parent{parent}, count{1} {}
+            AVLNode(Comparable&& value, AVLNode* left, AVLNode* right, int height, AVLNode* parent) 
+                : value{std::move(value)}, left{left}, right{right}, height{height}, parent{parent}, count{1} {}
+
+            // nodes are linked, never copied
+            AVLNode(const AVLNode&) = delete;
+            AVLNode& operator=(const AVLNode&) = delete;
+        };
 
+        // deferred reclamation: unlinked nodes wait here until no pinned reader can still reach them
+        struct EpochState {
+            static constexpr size_t slots = 64; // readers pinned at the same time
+            static constexpr size_t batch = 64; // retired nodes that trigger a reclaim
+
+            struct alignas(64) Slot {
+                std::atomic<uint64_t> epoch{0}; // 0 when not pinned
+            };
+
+            std::atomic<uint64_t> global{1};
+            Slot readers[slots];
+            std::vector<std::pair<AVLNode*, uint64_t>> retired{}; // node and the epoch it was retired in
+            size_t reclaimed{0};
         };
 
         AVLNode* root;
         size_t _size;
         AVLNode* min; // for O(1) iterator creation on begin
         AVLNode* max; // for O(1) iterator creation on end
+        std::unique_ptr<EpochState> epochs; // only allocated once deferred reclamation is enabled
+        size_t _version; // bumped on every link or unlink so cursors know to re-seek
+        size_t _rotations;
+        AVLNode* finger; // last node reached by a *_near call without an iterator
+
+        // node storage set aside by reserve, unused slots are chained through their first bytes
+        struct NodeBlock {
+            AVLNode* nodes;
+            size_t capacity;
+        };
+        std::vector<NodeBlock> blocks; // sorted by address
+        AVLNode* free_nodes;
+        size_t _free;       // slots on free_nodes
+        size_t _pooled;     // slots in blocks
+        size_t _heap_nodes; // nodes owned by the tree (linked or retired) that were allocated on their own
+
+        AVLNode* allocate_block(size_t capacity) { return std::allocator<AVLNode>().allocate(capacity); }
+
+        void push_free(AVLNode* slot) {
+            ::new (static_cast<void*>(slot)) AVLNode*(free_nodes);
+            free_nodes = slot;
+            _free++;
+        }
+
+        // first block starting past address, blocks are kept in address order for this search
+        typename std::vector<NodeBlock>::const_iterator block_after(const AVLNode* address) const {
+            std::less<const AVLNode*> before; // total order, even across blocks
+            return std::upper_bound(blocks.begin(), blocks.end(), address,
+                [&](const AVLNode* node, const NodeBlock& block) { return before(node, block.nodes); });
+        }
+
+        // a node is pooled if it lies in the last block starting at or before it
+        bool pooled(const AVLNode* node) const {
+            auto after = block_after(node);
+            if (after == blocks.begin()) return false;
+            --after;
+            return std::less<const AVLNode*>()(node, after->nodes + after->capacity);
+        }
+
+        // every node of the tree comes from here: a reserved slot if there is one, otherwise new
+        template <typename... Args>
+        AVLNode* make_node(Args&&... args) {
+            if (!free_nodes) {
+                AVLNode* node = new AVLNode(std::forward<Args>(args)...);
+                _heap_nodes++;
+                return node;
+            }
+
+            AVLNode* slot = free_nodes;
+            free_nodes = *std::launder(reinterpret_cast<AVLNode**>(slot));
+            _free--;
+            try {
+                return ::new (static_cast<void*>(slot)) AVLNode(std::forward<Args>(args)...);
+            } catch (...) {
+                push_free(slot);
+                throw;
+            }
+        }
+
+        void destroy_node(AVLNode* node) {
+            if (pooled(node)) {
+                node->~AVLNode();
+                push_free(node);
+            }
+            else {
+                delete node;
+                _heap_nodes--;
+            }
+        }
+
+        // hands a node to a node handle: unlinks it and, if it lives in reserved storage, moves it to the heap
+        // with pinned readers around the node itself is retired and the handle gets a fresh one, the value
+        // copied when it can be so a reader on the old node still sees it
+        AVLNode* release(AVLNode* node) {
+            if (epochs) {
+                AVLNode* fresh;
+                if constexpr (std::is_copy_constructible_v<Comparable>) fresh = new AVLNode(node->value, nullptr, nullptr, 1, nullptr);
+                else fresh = new AVLNode(std::move(node->value), nullptr, nullptr, 1, nullptr);
+                detach(node);
+                dispose(node);
+                return fresh;
+            }
+            if (!pooled(node)) {
+                detach(node);
+                _heap_nodes--;
+                return node;
+            }
+            // the heap node is built before anything is unlinked, so a throw leaves the tree as it was
+            AVLNode* moved = new AVLNode(std::move_if_noexcept(node->value), nullptr, nullptr, 1, nullptr);
+            detach(node);
+            node->~AVLNode();
+            push_free(node);
+            return moved;
+        }
+
+        // moves every node into a new block, in in-order sequence, and frees all other node storage
+        void relocate(size_t capacity) {
+            if (capacity < _size) capacity = _size;
+            if (epochs) {
+                // a pinned reader may hold any node, linked or retired
+                for (const typename EpochState::Slot& slot : epochs->readers) {
+                    if (slot.epoch.load()) throw std::logic_error("Can't move nodes while readers are pinned");
+                }
+                free_retired();
+            }
+
+            // every value is copied (or moved, where that can't throw) into the new block before the
+            // tree is touched, so a throw leaves it as it was
+            AVLNode* storage = capacity ? allocate_block(capacity) : nullptr;
+            std::vector<NodeBlock> kept;
+            size_t built = 0;
+            try {
+                if (storage) kept.push_back({storage, capacity});
+                for (iterator it = begin(); it.ptr; ++it, ++built) {
+                    ::new (static_cast<void*>(storage + built)) AVLNode(std::move_if_noexcept(it.ptr->value), nullptr, nullptr, it.ptr->height, nullptr);
+                }
+            } catch (...) {
+                for (size_t i = 0; i < built; i++) storage[i].~AVLNode();
+                if (storage) std::allocator<AVLNode>().deallocate(storage, capacity);
+                throw;
+            }
+
+            size_t next = 0;
+            root = relocate(root, storage, next);
+            if (root) root->parent = nullptr;
+            min = _size ? storage : nullptr;
+            max = _size ? storage + _size - 1 : nullptr;
+
+            for (const NodeBlock& block : blocks) std::allocator<AVLNode>().deallocate(block.nodes, block.capacity);
+            blocks.swap(kept);
+            free_nodes = nullptr;
+            _free = 0;
+            _pooled = capacity;
+            _heap_nodes = 0;
+            for (size_t i = capacity; i > _size; i--) push_free(storage + i - 1);
+            finger = nullptr;
+            _version++;
+        }
+
+        // links the nodes built in storage into old's shape and frees old's nodes; the n-th value in
+        // order was built in storage[n], so the left subtree goes first
+        AVLNode* relocate(AVLNode* old, AVLNode* storage, size_t& next) {
+            if (!old) return nullptr;
+
+            AVLNode* left = relocate(old->left, storage, next);
+            AVLNode* node = storage + next++;
+            node->left = left;
+            if (left) left->parent = node;
+            node->right = relocate(old->right, storage, next);
+            if (node->right) node->right->parent = node;
+            update(node);
+
+            if (pooled(old)) old->~AVLNode(); // its block is freed as a whole
+            else delete old;
+            return node;
+        }
+
+        // frees a node that was unlinked from the tree, or retires it while readers may still hold it
+        void dispose(AVLNode* node) {
+            if (!epochs) {
+                destroy_node(node);
+                return;
+            }
+            node->height = 0; // linked nodes are at least 1 high, see iterator::is_retired
+            epochs->retired.push_back({node, epochs->global.load()});
+            if (epochs->retired.size() >= EpochState::batch) reclaim();
+        }
+
+        void free_retired() {
+            if (!epochs) return;
+            for (const auto& retired : epochs->retired) destroy_node(retired.first);
+            epochs->reclaimed += epochs->retired.size();
+            epochs->retired.clear();
+        }
 
         // for copy constructor / copy assignment operator
-        AVLNode* copy(const AVLNode* root) {
+        AVLNode* copy(const AVLNode* root, AVLNode* parent) {
             if (!root) return nullptr;
-            return new AVLNode(root->value, copy(root->left), copy(root->right), root->height, root->parent);
+            AVLNode* node = make_node(root->value, nullptr, nullptr, root->height, parent);
+            node->left = copy(root->left, node);
+            node->right = copy(root->right, node);
+            update(node);
+            return node;
         }
 
         void setMinMax() {
+            if (!root) {
+                min = max = nullptr;
+                return;
+            }
             AVLNode* curr = root;
             // for constant iterator creation
             while (curr->left) curr = curr->left;
@@ -51,6 +403,119 @@ class AVLTree {
         // helper method for rebalance methods
         int height(const AVLNode* node) const { return !node ? 0 : node->height; } // must avoid nullptr->height
 
+        static size_t count(const AVLNode* node) noexcept { return !node ? 0 : node->count; }
+
+        // recompute height, subtree size and augmented data from node's children
+        // ranks aren't derived from the children, only the rank rebalancing steps change them
+        void update(AVLNode* node) {
+            if constexpr (!Balance::rank_balanced)
+                node->height = (height(node->left) > height(node->right) ? height(node->left) : height(node->right)) + 1;
+            node->count = count(node->left) + count(node->right) + 1;
+            AVLAugment<Comparable>::update(node);
+        }
+
+        // number of values before node
+        static size_t position(const AVLNode* node) noexcept {
+            size_t index = count(node->left);
+            for (; node->parent; node = node->parent) {
+                if (node == node->parent->right) index += count(node->parent->left) + 1;
+            }
+            return index;
+        }
+
+        // the node holding the value at index in root's subtree, or nullptr past the end
+        static AVLNode* select(AVLNode* root, size_t index) noexcept {
+            while (root) {
+                const size_t before = count(root->left);
+                if (index < before) root = root->left;
+                else if (index == before) break;
+                else {
+                    index -= before + 1;
+                    root = root->right;
+                }
+            }
+            return root;
+        }
+
+        // number of values less than value
+        size_t count_less(const Comparable& value) const {
+            size_t less = 0;
+            for (const AVLNode* node = root; node;) {
+                if (node->value < value) {
+                    less += count(node->left) + 1;
+                    node = node->right;
+                }
+                else node = node->left;
+            }
+            return less;
+        }
+
+        // parallel walks split the tree into whole subtrees of at most parallel_grain values and
+        // the single nodes between them, in order; the split depends on the shape only, not on
+        // the thread count, so an in-order reduce gives the same result for any thread count
+        static constexpr size_t parallel_grain = 4096;
+
+        struct ParallelTask {
+            const AVLNode* node;
+            bool subtree; // node alone otherwise
+        };
+
+        static void split_tasks(const AVLNode* node, std::vector<ParallelTask>& tasks) {
+            if (!node) return;
+            if (count(node) <= parallel_grain) {
+                tasks.push_back({node, true});
+                return;
+            }
+            split_tasks(node->left, tasks);
+            tasks.push_back({node, false});
+            split_tasks(node->right, tasks);
+        }
+
+        template <typename F>
+        static void visit(const AVLNode* node, F& f) {
+            for (; node; node = node->right) {
+                visit(node->left, f);
+                f(node->value);
+            }
+        }
+
+        // runs work(task) for tasks 0 to tasks - 1 on up to threads threads, the calling thread
+        // included, each thread taking the next task as it finishes one; the first exception
+        // stops handing out tasks and is rethrown once every thread is done
+        template <typename F>
+        static void run_tasks(size_t tasks, unsigned threads, F work) {
+            if (tasks == 0) return;
+            if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+            std::atomic<size_t> next{0};
+            std::exception_ptr error;
+            std::mutex error_lock;
+            auto worker = [&] {
+                for (size_t task; (task = next.fetch_add(1)) < tasks;) {
+                    try {
+                        work(task);
+                    }
+                    catch (...) {
+                        std::lock_guard<std::mutex> lock(error_lock);
+                        if (!error) error = std::current_exception();
+                        next = tasks;
+                    }
+                }
+            };
+
+            std::vector<std::thread> workers;
+            const size_t helpers = std::min<size_t>(threads, tasks) - 1;
+            try {
+                workers.reserve(helpers);
+                for (size_t i = 0; i < helpers; i++) workers.emplace_back(worker);
+            } catch (const std::system_error&) {
+                // out of threads: the ones already started and this one share the remaining tasks
+            } catch (const std::bad_alloc&) {}
+            worker();
+            for (std::thread& helper : workers) helper.join();
+            if (error) std::rethrow_exception(error);
+        }
+
         // methods for rebalancing
         void single_left_rotation(AVLNode* &root) {
             // adjust parent pointers
@@ -63,9 +528,10 @@ class AVLTree {
             root->right = right_child->left;
             right_child->left = root;
 
-            // fix height
-            right_child->height = (height(right_child->left) > height(right_child->right) ? height(right_child->left) : height(right_child->right)) + 1;
-            root->height = (height(root->left) > height(root->right) ? height(root->left) : height(root->right)) + 1;
+            // fix height, the old root is now the child
+            update(root);
+            update(right_child);
+            _rotations++;
 
             root = right_child;
         }
@@ -81,9 +547,10 @@ class AVLTree {
             root->left = left_child->right;
             left_child->right = root;
 
-            // fix height
-            left_child->height = (height(left_child->left) > height(left_child->right) ? height(left_child->left) : height(left_child->right)) + 1;
-            root->height = (height(root->left) > height(root->right) ? height(root->left) : height(root->right)) + 1;
+            // fix height, the old root is now the child
+            update(root);
+            update(left_child);
+            _rotations++;
 
             root = left_child;
         }
@@ -101,20 +568,20 @@ class AVLTree {
         void rebalance(AVLNode* &root) {
             if (!root) return;
 
-            if (height(root->left) - height(root->right) > 1) {
+            if (height(root->left) - height(root->right) > Balance::slack) {
                 if (height(root->left->left) >= height(root->left->right))
                     single_right_rotation(root);
                 else 
                     double_right_rotation(root);
             }
-            else if (height(root->right) - height(root->left) > 1) {
+            else if (height(root->right) - height(root->left) > Balance::slack) {
                 if (height(root->right->right) >= height(root->right->left))
                     single_left_rotation(root);
                 else
                     double_left_rotation(root);
             }
             
-            root->height = (height(root->left) > height(root->right) ? height(root->left) : height(root->right)) + 1;
+            update(root);
         }
 
         // helper methods for public methods
@@ -149,81 +616,325 @@ class AVLTree {
             if (root->left) print_tree(root->left, os, depth + 1);
         }
 
-        void insert(const Comparable& value, AVLNode* &root, AVLNode* parent) {
-            if (!root) {
-                root = new AVLNode(value, parent);
+        // the link (parent's child pointer or root) that points at node
+        AVLNode*& link(AVLNode* node) {
+            if (!node->parent) return root;
+            return node->parent->left == node ? node->parent->left : node->parent->right;
+        }
 
-                if (_size == 0) {
-                    min = root;
-                    max = root;
+        // restore balance from node towards the root
+        // once a subtree keeps its height without rotating nothing above it can need a rotation,
+        // so the rest of the way only subtree sizes and augmented data are recomputed
+        void rebalance_upward(AVLNode* node) {
+            while (node) {
+                AVLNode* &subtree = link(node);
+                const int old_height = node->height;
+                rebalance(subtree);
+                if (subtree == node && node->height == old_height) {
+                    carry_up(node->parent);
+                    break;
                 }
-                else if (min->value > value) 
-                    min = root; 
-                else if (max->value < value) 
-                    max = root;
-
-                _size++; 
+                node = subtree->parent;
             }
+        }
 
-            else if (value < root->value)
-                insert(value, root->left, root);
-            else if (value > root->value)
-                insert(value, root->right, root);
+        // rank balanced rebalancing (see Haeupler, Sen and Tarjan, "Rank-Balanced Trees")
+        // ranks live in height as rank + 1, so rank differences are height differences
+        // and a missing child has rank -1
+        int rank_difference(const AVLNode* parent, const AVLNode* child) const { return height(parent) - height(child); }
+
+        // a new leaf can leave a parent with a 0-child: promote up the tree, then rotate at most once
+        void rank_insert_fixup(AVLNode* node) {
+            for (AVLNode* x = node; x;) {
+                const bool left = rank_difference(x, x->left) == 0;
+                if (!left && rank_difference(x, x->right) != 0) break;
+
+                AVLNode* sibling = left ? x->right : x->left;
+                if (rank_difference(x, sibling) == 1) {
+                    x->height++;
+                    x = x->parent;
+                    continue;
+                }
 
-            rebalance(root);
+                AVLNode* child = left ? x->left : x->right;
+                AVLNode* inner = left ? child->right : child->left;
+                if (rank_difference(child, inner) == 2) {
+                    left ? single_right_rotation(link(x)) : single_left_rotation(link(x));
+                    x->height--;
+                }
+                else {
+                    left ? double_right_rotation(link(x)) : double_left_rotation(link(x));
+                    inner->height++;
+                    child->height--;
+                    x->height--;
+                }
+                break;
+            }
+            carry_up(node);
         }
 
-        void remove(const Comparable& value, AVLNode* &root) {
-            if (!root) return;
+        // an unlink can leave a leaf of rank 1 or a parent with a 3-child: demote up the tree, then rotate at most once
+        void rank_remove_fixup(AVLNode* node) {
+            for (AVLNode* x = node; x;) {
+                if (!x->left && !x->right) {
+                    if (x->height == 1) break;
+                    x->height = 1;
+                    x = x->parent;
+                    continue;
+                }
 
-            if (value < root->value) remove(value, root->left);
+                const bool left = rank_difference(x, x->left) == 3;
+                if (!left && rank_difference(x, x->right) != 3) break;
 
-            else if (value > root->value) remove(value, root->right);
+                AVLNode* sibling = left ? x->right : x->left;
+                if (rank_difference(x, sibling) == 2) {
+                    x->height--;
+                    x = x->parent;
+                    continue;
+                }
+                if (rank_difference(sibling, sibling->left) == 2 && rank_difference(sibling, sibling->right) == 2) {
+                    x->height--;
+                    sibling->height--;
+                    x = x->parent;
+                    continue;
+                }
+
+                AVLNode* outer = left ? sibling->right : sibling->left;
+                AVLNode* inner = left ? sibling->left : sibling->right;
+                if (rank_difference(sibling, outer) == 1) {
+                    left ? single_left_rotation(link(x)) : single_right_rotation(link(x));
+                    sibling->height++;
+                    x->height--;
+                    if (!x->left && !x->right) x->height = 1;
+                }
+                else {
+                    left ? double_left_rotation(link(x)) : double_right_rotation(link(x));
+                    inner->height += 2;
+                    sibling->height--;
+                    x->height -= 2;
+                }
+                break;
+            }
+            carry_up(node);
+        }
 
-            else if (root->left && root->right) {
-                root->value = find_min(root->right);
-                remove(root->value, root->right);
-            } 
+        // rebalancing stops early, subtree sizes and augmented data still have to reach the root;
+        // a new or removed node changes the size of every ancestor, so this walk can't stop early
+        void carry_up(AVLNode* node) {
+            for (; node; node = node->parent) update(node);
+        }
 
+        // checks the subtree under node against the values (low, high) it must lie between and
+        // the balance policy, counting its nodes; returns its height or -1 if anything is off
+        int validate(const AVLNode* node, const AVLNode* parent, const AVLNode* low, const AVLNode* high, size_t& count) const {
+            if (!node) return 0;
+            if (node->parent != parent) return -1;
+            if ((low && !(low->value < node->value)) || (high && !(node->value < high->value))) return -1;
+            const size_t before = count++;
+
+            const int left = validate(node->left, node, low, node, count);
+            const int right = validate(node->right, node, node, high, count);
+            if (left < 0 || right < 0 || node->count != count - before) return -1;
+
+            if constexpr (Balance::rank_balanced) {
+                const int left_difference = node->height - height(node->left);
+                const int right_difference = node->height - height(node->right);
+                if (left_difference < 1 || left_difference > 2 || right_difference < 1 || right_difference > 2) return -1;
+                if (!node->left && !node->right && node->height != 1) return -1;
+            }
             else {
-                if (min == root) {
-                    if (root->right)
-                        min = root->right;
-                    else
-                        min = root->parent;
+                if (node->height != (left > right ? left : right) + 1) return -1;
+                if (left - right > Balance::slack || right - left > Balance::slack) return -1;
+            }
+            return (left > right ? left : right) + 1;
+        }
+
+        // links sorted[first, last) into a perfectly balanced subtree
+        AVLNode* build_balanced(const std::vector<AVLNode*>& sorted, size_t first, size_t last, AVLNode* parent) {
+            if (first == last) return nullptr;
+
+            const size_t middle = first + (last - first) / 2;
+            AVLNode* node = sorted[middle];
+            node->parent = parent;
+            node->left = build_balanced(sorted, first, middle, node);
+            node->right = build_balanced(sorted, middle + 1, last, node);
+            // heights of a perfectly balanced tree are valid ranks too
+            node->height = (height(node->left) > height(node->right) ? height(node->left) : height(node->right)) + 1;
+            update(node);
+            return node;
+        }
+
+        AVLNode* find(const Comparable& value, AVLNode* root) const {
+            while (root) {
+                if (value < root->value) root = root->left;
+                else if (value > root->value) root = root->right;
+                else break;
+            }
+            return root;
+        }
+
+        // finger search: climbs from node only while value lies outside the subtree being left,
+        // so the subtree returned holds value or the empty link it belongs at; that is O(log d)
+        // levels for d values between node and value, except that neighbours on either side of a
+        // high ancestor still climb to it
+        AVLNode* climb(AVLNode* node, const Comparable& value) const {
+            const bool smaller = value < node->value;
+            while (node->parent && (value < node->value || value > node->value)) {
+                AVLNode* parent = node->parent;
+                if (smaller ? node == parent->right && parent->value < value
+                            : node == parent->left && value < parent->value) break;
+                node = parent;
+            }
+            return node;
+        }
+
+        // searches from finger (the root if null), returns value's node, or nullptr with last set
+        // to the node value would be linked under
+        AVLNode* find_from(AVLNode* finger, const Comparable& value, AVLNode* &last) const {
+            last = nullptr;
+            AVLNode* node = finger ? climb(finger, value) : root;
+            while (node) {
+                last = node;
+                if (value < node->value) node = node->left;
+                else if (value > node->value) node = node->right;
+                else return node;
+            }
+            return nullptr;
+        }
+
+        // returns the link where value is (or belongs), parent is set to the owner of that link
+        AVLNode*& find_slot(const Comparable& value, AVLNode* &parent) {
+            parent = nullptr;
+            AVLNode** slot = &root;
+            while (*slot) {
+                if (value < (*slot)->value) {
+                    parent = *slot;
+                    slot = &parent->left;
                 }
-                if (max == root) {
-                    if (root->left)
-                        max = root->left;
-                    else
-                        max = root->parent;
+                else if (value > (*slot)->value) {
+                    parent = *slot;
+                    slot = &parent->right;
                 }
+                else break;
+            }
+            return *slot;
+        }
+
+        // links a detached node into the empty slot found by find_slot
+        void attach(AVLNode* node, AVLNode* &slot, AVLNode* parent) {
+            update(node);
+            node->parent = parent;
+            slot = node;
+
+            if (_size == 0) {
+                min = node;
+                max = node;
+            }
+            else if (parent == min && parent->left == node) 
+                min = node;
+            else if (parent == max && parent->right == node) 
+                max = node;
+
+            _size++;
+            _version++;
+            if constexpr (Balance::rank_balanced) rank_insert_fixup(parent);
+            else rebalance_upward(parent);
+        }
+
+        // returns the node holding value, creating it if needed
+        AVLNode* insert_node(const Comparable& value) {
+            AVLNode* parent;
+            AVLNode* &slot = find_slot(value, parent);
+            if (slot) return slot;
 
-                // update tree structure and parent pointers
-                AVLNode* old_root = root;
-                if (root->left) {
-                    root->left->parent = root->parent;
-                    root = root->left;
+            AVLNode* node = make_node(value, parent);
+            attach(node, slot, parent);
+            return node;
+        }
+
+        // unlinks node from the tree without freeing it
+        // the in-order successor takes its place, so no values are copied
+        void detach(AVLNode* node) {
+            if (finger == node) finger = nullptr;
+            if (min == node) {
+                if (node->right) {
+                    min = node->right;
+                    while (min->left) min = min->left;
+                }
+                else
+                    min = node->parent;
+            }
+            if (max == node) {
+                if (node->left) {
+                    max = node->left;
+                    while (max->right) max = max->right;
+                }
+                else
+                    max = node->parent;
+            }
+
+            AVLNode* &slot = link(node);
+            AVLNode* changed; // deepest node whose subtree lost a node
+            if (node->left && node->right) {
+                AVLNode* successor = node->right;
+                while (successor->left) successor = successor->left;
+
+                if (successor->parent == node) {
+                    changed = successor;
                 }
                 else {
-                    if (root->right) root->right->parent = root->parent;
-                    root = root->right;
+                    changed = successor->parent;
+                    changed->left = successor->right;
+                    if (successor->right) successor->right->parent = changed;
+                    successor->right = node->right;
+                    node->right->parent = successor;
                 }
 
-                delete old_root;
-                _size--;
+                successor->left = node->left;
+                node->left->parent = successor;
+                successor->parent = node->parent;
+                successor->height = node->height;
+                slot = successor;
             }
+            else {
+                AVLNode* child = node->left ? node->left : node->right;
+                if (child) child->parent = node->parent;
+                slot = child;
+                changed = node->parent;
+            }
+
+            node->left = nullptr;
+            node->right = nullptr;
+            node->parent = nullptr;
+            node->height = 1;
+            node->count = 1;
+            _size--;
+            _version++;
 
-            rebalance(root);
+            if constexpr (Balance::rank_balanced) rank_remove_fixup(changed);
+            else rebalance_upward(changed);
         }
 
     public:
         class iterator;
-
-        iterator begin() noexcept { return iterator(min, max); }
-        iterator end() noexcept { return iterator(max->right, max); }
+        // values can't be modified in place without breaking the ordering, so like std::set both iterators are constant
+        using const_iterator = iterator;
+        using reverse_iterator = std::reverse_iterator<iterator>;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+        class node_type;
+        struct insert_return_type;
+
+        iterator begin() const noexcept { return iterator(min, max); }
+        iterator end() const noexcept { return iterator(nullptr, max); }
+        const_iterator cbegin() const noexcept { return begin(); }
+        const_iterator cend() const noexcept { return end(); }
+        reverse_iterator rbegin() const noexcept { return reverse_iterator(end()); }
+        reverse_iterator rend() const noexcept { return reverse_iterator(begin()); }
+        const_reverse_iterator crbegin() const noexcept { return rbegin(); }
+        const_reverse_iterator crend() const noexcept { return rend(); }
         
-        AVLTree() : root{nullptr}, _size{}, min{nullptr}, max{nullptr} {}
+        AVLTree() : root{nullptr}, _size{}, min{nullptr}, max{nullptr}, epochs{}, _version{}, _rotations{}, finger{nullptr}, 
+                    blocks{}, free_nodes{nullptr}, _free{}, _pooled{}, _heap_nodes{} {}
         // lookup
         bool contains(const Comparable& value) const { return contains(value, root); }
         const Comparable& find_min() const { 
@@ -235,18 +946,345 @@ class AVLTree {
             return max->value;
         }
 
+        // first value not less than value, or end()
+        iterator lower_bound(const Comparable& value) const {
+            AVLNode* node = root;
+            AVLNode* bound = nullptr;
+            while (node) {
+                if (node->value < value) node = node->right;
+                else {
+                    bound = node;
+                    node = node->left;
+                }
+            }
+            return iterator(bound, max);
+        }
+
+        // first value greater than value, or end()
+        iterator upper_bound(const Comparable& value) const {
+            AVLNode* node = root;
+            AVLNode* bound = nullptr;
+            while (node) {
+                if (value < node->value) {
+                    bound = node;
+                    node = node->left;
+                }
+                else node = node->right;
+            }
+            return iterator(bound, max);
+        }
+
+        // order statistics, O(log n) each from the subtree sizes
+        // number of values in [lo, hi)
+        size_t count_between(const Comparable& lo, const Comparable& hi) const {
+            if (!(lo < hi)) return 0;
+            return count_less(hi) - count_less(lo);
+        }
+
+        // the value at quantile q in [0, 1] by nearest rank: the smallest value with at least
+        // q * size() values at or below it, so quantile(0.5) is the lower median
+        const Comparable& quantile(double q) const {
+            if (!root) throw std::invalid_argument("The tree is empty");
+            if (!(q >= 0.0 && q <= 1.0)) throw std::invalid_argument("Quantiles are between 0 and 1");
+
+            size_t rank = static_cast<size_t>(std::ceil(q * static_cast<double>(_size)));
+            if (rank > 0) rank--;
+            if (rank >= _size) rank = _size - 1;
+            return select(root, rank)->value;
+        }
+
+        // k distinct values chosen uniformly at random (all of them if k >= size()), in sorted order
+        // positions are drawn with Floyd's algorithm, then each is found in O(log n)
+        template <typename URBG>
+        std::vector<Comparable> sample(size_t k, URBG&& rng) const {
+            if (k > _size) k = _size;
+            std::vector<size_t> positions;
+            positions.reserve(k);
+            std::unordered_set<size_t> chosen;
+            for (size_t j = _size - k; j < _size; j++) {
+                size_t position = std::uniform_int_distribution<size_t>(0, j)(rng);
+                if (!chosen.insert(position).second) {
+                    position = j; // j can't have been chosen yet
+                    chosen.insert(j);
+                }
+                positions.push_back(position);
+            }
+            std::sort(positions.begin(), positions.end());
+
+            std::vector<Comparable> values;
+            values.reserve(k);
+            for (size_t position : positions) values.push_back(select(root, position)->value);
+            return values;
+        }
+
+        // finger search, for lookups that land close to the previous one
+        // searches outward from position (end() starts from the largest value) instead of the root
+        iterator find_near(iterator position, const Comparable& value) const {
+            AVLNode* last;
+            AVLNode* node = find_from(position.ptr ? position.ptr : max, value, last);
+            return iterator(node, max);
+        }
+
+        // the same from the node the previous *_near call stopped at, which these calls keep up
+        // to date; not safe to call from concurrent readers, unlike the const lookups
+        iterator find_near(const Comparable& value) {
+            AVLNode* last;
+            AVLNode* node = find_from(finger, value, last);
+            finger = node ? node : last;
+            return iterator(node, max);
+        }
+
+#ifdef AVL_HAS_COROUTINES
+        // interleavable lookups: each step prefetches the next node and suspends
+        // value is taken by copy since the lookup outlives the call; the tree must outlive the lookup
+        AVLLookup<bool> co_contains(Comparable value) const {
+            const AVLNode* node = root;
+            while (node) {
+                co_await AVLPrefetch{node};
+                if (value < node->value) node = node->left;
+                else if (value > node->value) node = node->right;
+                else co_return true;
+            }
+            co_return false;
+        }
+
+        AVLLookup<iterator> co_lower_bound(Comparable value) const {
+            AVLNode* node = root;
+            AVLNode* bound = nullptr;
+            while (node) {
+                co_await AVLPrefetch{node};
+                if (node->value < value) node = node->right;
+                else {
+                    bound = node;
+                    node = node->left;
+                }
+            }
+            co_return iterator(bound, max);
+        }
+#endif
+
+        // streaming in-order scan, see cursor
+        class cursor;
+        cursor scan() const { return cursor(this); }
+
         // visualization
         void print_tree(std::ostream& os = std::cout) const { print_tree(root, os); }
         
         // modifiers
-        void insert(const Comparable& value) { insert(value, root, nullptr); }
-        void remove(const Comparable& value) { remove(value, root); }
+        void insert(const Comparable& value) { insert_node(value); }
+
+        // inserts value just before hint when that is where it belongs, otherwise falls back to insert
+        // a correct hint costs two comparisons instead of a search from the root
+        iterator insert(iterator hint, const Comparable& value) {
+            AVLNode* next = hint.ptr;
+            AVLNode* prev = next ? (--hint).ptr : max;
+
+            if ((!next || value < next->value) && (!prev || prev->value < value)) {
+                // prev and next are adjacent, so either next->left or prev->right is free
+                AVLNode* parent = next && !next->left ? next : prev;
+                AVLNode* node = make_node(value, parent);
+                attach(node, !parent ? root : (parent == next ? next->left : prev->right), parent);
+                return iterator(node, max);
+            }
+
+            AVLNode* node = insert_node(value);
+            return iterator(node, max);
+        }
+
+        // inserts value searching from where the previous *_near call stopped, see find_near
+        iterator insert_near(const Comparable& value) {
+            AVLNode* parent;
+            AVLNode* node = find_from(finger, value, parent);
+            if (!node) {
+                node = make_node(value, parent);
+                attach(node, !parent ? root : (value < parent->value ? parent->left : parent->right), parent);
+            }
+            finger = node;
+            return iterator(node, max);
+        }
+
+        // fast path for keys that arrive in increasing order (timestamps, ids)
+        // links the value straight below the cached max with a single comparison instead of a search;
+        // linking is still O(log n), since every ancestor's subtree size changes
+        void append_max(const Comparable& value) {
+            if (max && max->value < value) 
+                attach(make_node(value, max), max->right, max);
+            else 
+                insert_node(value);
+        }
+
+        void remove(const Comparable& value) {
+            AVLNode* node = find(value, root);
+            if (!node) return;
+            detach(node);
+            dispose(node);
+        }
+
+        // removes value searching from where the previous *_near call stopped, which then
+        // moves on to the value's successor (or predecessor at the end)
+        void remove_near(const Comparable& value) {
+            AVLNode* last;
+            AVLNode* node = find_from(finger, value, last);
+            if (!node) {
+                finger = last;
+                return;
+            }
+            iterator next(node, max);
+            ++next;
+            AVLNode* neighbor = next.ptr ? next.ptr : (--iterator(node, max)).ptr;
+            detach(node);
+            dispose(node);
+            finger = neighbor;
+        }
+
+        // node handles: move nodes between trees without reallocating or copying values
+        // (a node in storage set aside by reserve is moved to the heap, since that storage stays with the tree)
+        node_type extract(const Comparable& value) {
+            AVLNode* node = find(value, root);
+            return node_type(node ? release(node) : nullptr);
+        }
+
+        node_type extract(iterator position) {
+            if (!position.ptr) return node_type();
+            return node_type(release(position.ptr));
+        }
+
+        insert_return_type insert(node_type&& handle) {
+            if (handle.empty()) return {end(), false, node_type()};
+
+            AVLNode* parent;
+            AVLNode* &slot = find_slot(handle.node->value, parent);
+            if (slot) return {iterator(slot, max), false, std::move(handle)};
+
+            AVLNode* node = handle.node;
+            handle.node = nullptr;
+            _heap_nodes++;
+            attach(node, slot, parent);
+            return {iterator(node, max), true, node_type()};
+        }
+
+        // splices every node of source whose value is not already in this tree
+        void merge(AVLTree& source) {
+            if (&source == this) return;
+
+            AVLNode* node = source.min;
+            while (node) {
+                iterator next(node, source.max);
+                ++next;
+
+                AVLNode* parent;
+                AVLNode* &slot = find_slot(node->value, parent);
+                if (!slot) {
+                    AVLNode* moved = source.release(node);
+                    _heap_nodes++;
+                    attach(moved, slot, parent);
+                }
+                node = next.ptr;
+            }
+        }
 
         // capacity
         size_t size() const noexcept { return _size; }
         bool is_empty() const noexcept{ return !root; }
         void make_empty() { clear(); }
 
+        // checks every invariant in O(n): ordering, parent links, heights (or ranks) and balance
+        // under the tree's policy, subtree sizes, size, min and max; for tests and debugging
+        bool validate() const {
+            if (root && root->parent) return false;
+
+            size_t count = 0;
+            if (validate(root, nullptr, nullptr, nullptr, count) < 0 || count != _size) return false;
+
+            const AVLNode* leftmost = root;
+            const AVLNode* rightmost = root;
+            while (leftmost && leftmost->left) leftmost = leftmost->left;
+            while (rightmost && rightmost->right) rightmost = rightmost->right;
+            return min == leftmost && max == rightmost;
+        }
+
+        // parallel traversal, threads = 0 uses every hardware thread
+        // the tree must not change during the call
+        // calls f on every value, from several threads at once and in no particular order,
+        // so f has to be safe to call concurrently
+        template <typename F>
+        void parallel_for_each(F f, unsigned threads = 0) const {
+            std::vector<ParallelTask> tasks;
+            split_tasks(root, tasks);
+            run_tasks(tasks.size(), threads, [&](size_t i) {
+                if (tasks[i].subtree) visit(tasks[i].node, f);
+                else f(tasks[i].node->value);
+            });
+        }
+
+        // folds every value (converted to T) into init with op in sorted order, e.g. a sum
+        // op must be associative, it doesn't have to be commutative: the pieces are reduced in
+        // parallel and combined left to right, the same way whatever the thread count
+        template <typename T, typename Op>
+        T parallel_reduce(T init, Op op, unsigned threads = 0) const {
+            std::vector<ParallelTask> tasks;
+            split_tasks(root, tasks);
+            std::vector<std::optional<T>> partial(tasks.size());
+            run_tasks(tasks.size(), threads, [&](size_t i) {
+                std::optional<T>& sum = partial[i];
+                auto add = [&](const Comparable& value) {
+                    if (sum) sum = op(std::move(*sum), T(value));
+                    else sum.emplace(value);
+                };
+                if (tasks[i].subtree) visit(tasks[i].node, add);
+                else add(tasks[i].node->value);
+            });
+            for (std::optional<T>& sum : partial) init = op(std::move(init), std::move(*sum));
+            return init;
+        }
+
+        // balance
+        // single rotations done since construction, a double rotation counts as two
+        size_t rotation_count() const noexcept { return _rotations; }
+
+        // relinks every node into a perfectly balanced tree in O(n) without allocating, e.g. after
+        // a burst of writes under AVLRelaxed; iterators stay valid
+        void rebalance_all() {
+            std::vector<AVLNode*> sorted;
+            sorted.reserve(_size);
+            for (iterator it = begin(); it != end(); ++it) sorted.push_back(it.ptr);
+            root = build_balanced(sorted, 0, sorted.size(), nullptr);
+            _version++;
+        }
+
+        // memory
+        // nodes that can be linked without allocating
+        size_t capacity() const noexcept { return _size + _free; }
+
+        // sets aside storage so the tree can hold n values without allocating a node
+        void reserve(size_t n) {
+            if (n <= capacity()) return;
+            size_t count = n - capacity();
+            AVLNode* nodes = allocate_block(count);
+            try {
+                blocks.insert(block_after(nodes), {nodes, count});
+            } catch (...) {
+                std::allocator<AVLNode>().deallocate(nodes, count);
+                throw;
+            }
+            _pooled += count;
+            for (size_t i = count; i > 0; i--) push_free(nodes + i - 1);
+        }
+
+        // memory taken up by linked nodes
+        size_t bytes_used() const noexcept { return _size * sizeof(AVLNode); }
+
+        // all node memory held by the tree: reserved blocks, nodes allocated on their own and retired nodes
+        size_t bytes_reserved() const noexcept { return (_pooled + _heap_nodes) * sizeof(AVLNode); }
+
+        // moves the nodes into one block of reserved storage laid out in sorted order, so that walking
+        // the tree in order touches memory sequentially; keeps the reserved capacity
+        // invalidates iterators and throws std::logic_error while any reader is pinned
+        void compact() { relocate(_pooled > _size ? _pooled : _size); }
+
+        // compact, releasing every slot not holding a value
+        void shrink_to_fit() { relocate(_size); }
+
         // rule of three
         void clear() {
             while(!is_empty()) {
@@ -254,42 +1292,277 @@ class AVLTree {
             }
         }
 
-        AVLTree(const AVLTree& other) : root{}, _size{}, min{}, max{} { 
-            root = copy(other.root);
+        AVLTree(const AVLTree& other) : root{}, _size{other._size}, min{}, max{}, epochs{}, _version{}, _rotations{}, finger{nullptr}, 
+                                        blocks{}, free_nodes{nullptr}, _free{}, _pooled{}, _heap_nodes{} { 
+            root = copy(other.root, nullptr);
             setMinMax(); // for constant iterator creation
         }
 
-        ~AVLTree() { clear(); }
+        ~AVLTree() { 
+            clear(); 
+            free_retired(); // no reader can outlive the tree
+            for (const NodeBlock& block : blocks) std::allocator<AVLNode>().deallocate(block.nodes, block.capacity);
+        }
         AVLTree& operator=(const AVLTree& rhs) {
             if (this != &rhs) {
                 clear();
-                root = copy(rhs.root);
+                root = copy(rhs.root, nullptr);
+                _size = rhs._size;
+                _version++;
                 setMinMax(); // for constant iterator creation
             }
             return *this;
         }
 
+        // concurrent readers
+        // Once enabled, remove and clear retire nodes instead of deleting them. A reader that pins the
+        // tree can keep walking iterators and parent chains between its (locked) steps without ever
+        // touching freed memory; retired nodes are freed in batches once every pinned reader has moved
+        // on to a later epoch. Writers still have to be serialized with each reader step.
+        // A removed node is unlinked, so an iterator left on one still reads its value but its walk
+        // ends there: ++ and -- give end(). A reader scanning with iterators checks is_retired()
+        // before stepping and re-seeks with upper_bound(*it) (or lower_bound going down); a cursor
+        // (see scan) does that by itself.
+        // Call before the tree is shared between threads.
+        class read_guard;
+
+        struct reclamation_stats {
+            size_t retired_nodes;   // unlinked, waiting for readers
+            size_t retired_bytes;   // memory held by those nodes
+            size_t overhead_bytes;  // reader slots and retire list
+            size_t reclaimed_nodes; // freed so far
+            uint64_t lag;           // epochs the oldest retired node has been waiting
+        };
+
+        void enable_deferred_reclamation() {
+            if (!epochs) epochs = std::make_unique<EpochState>();
+        }
+
+        // keeps every node reachable now alive until the guard is destroyed
+        read_guard pin() const {
+            if (!epochs) throw std::invalid_argument("Deferred reclamation is not enabled");
+
+            for (;;) {
+                uint64_t epoch = epochs->global.load();
+                for (typename EpochState::Slot& slot : epochs->readers) {
+                    uint64_t free = 0;
+                    if (!slot.epoch.compare_exchange_strong(free, epoch)) continue;
+
+                    // a reclaim may have advanced the epoch before the slot was published
+                    uint64_t now;
+                    while ((now = epochs->global.load()) != epoch) {
+                        epoch = now;
+                        slot.epoch.store(epoch);
+                    }
+                    return read_guard(slot.epoch);
+                }
+                std::this_thread::yield(); // every slot is taken
+            }
+        }
+
+        // frees every retired node no pinned reader can reach, returns how many were freed
+        size_t reclaim() {
+            if (!epochs) return 0;
+
+            // readers pinning from here on can't reach anything retired so far
+            uint64_t oldest = epochs->global.fetch_add(1) + 1;
+            for (const typename EpochState::Slot& slot : epochs->readers) {
+                uint64_t epoch = slot.epoch.load();
+                if (epoch && epoch < oldest) oldest = epoch;
+            }
+
+            size_t kept = 0;
+            std::vector<std::pair<AVLNode*, uint64_t>>& retired = epochs->retired;
+            for (size_t i = 0; i < retired.size(); i++) {
+                if (retired[i].second < oldest) destroy_node(retired[i].first);
+                else retired[kept++] = retired[i];
+            }
+            size_t freed = retired.size() - kept;
+            retired.resize(kept);
+            epochs->reclaimed += freed;
+            return freed;
+        }
+
+        reclamation_stats reclamation_status() const {
+            if (!epochs) return {0, 0, 0, 0, 0};
+            const std::vector<std::pair<AVLNode*, uint64_t>>& retired = epochs->retired;
+            uint64_t lag = retired.empty() ? 0 : epochs->global.load() - retired.front().second;
+            return {
+                retired.size(),
+                retired.size() * sizeof(AVLNode),
+                sizeof(EpochState) + retired.capacity() * sizeof(retired.front()),
+                epochs->reclaimed,
+                lag
+            };
+        }
+
         // FOR TESTING ONLY
         const AVLNode* getRoot() const { return root; }
+
+        // Copies values out in sorted order, a batch at a time, for bulk export.
+        // Keeps an explicit stack of the nodes still to visit instead of climbing parent pointers, and
+        // prefetches each right subtree as its parent is pushed. If the tree is modified between batches
+        // the cursor re-seeks past the last value it returned, so it stays valid across inserts and removes.
+        class cursor {
+            friend class AVLTree;
+
+            const AVLTree* tree;
+            std::vector<const AVLNode*> path; // nodes whose value and right subtree are still to come
+            std::optional<Comparable> last;
+            size_t version;
+
+            explicit cursor(const AVLTree* tree) : tree{tree}, path{}, last{}, version{tree->_version} {
+                path.reserve(64);
+                descend_left(tree->root);
+            }
+
+            void descend_left(const AVLNode* node) {
+                while (node) {
+                    AVL_PREFETCH(node->right);
+                    path.push_back(node);
+                    node = node->left;
+                }
+            }
+
+            // rebuild the stack for the values after last
+            void seek() {
+                path.clear();
+                version = tree->_version;
+                const AVLNode* node = tree->root;
+                while (node) {
+                    if (last && !(*last < node->value)) node = node->right;
+                    else {
+                        AVL_PREFETCH(node->right);
+                        path.push_back(node);
+                        node = node->left;
+                    }
+                }
+            }
+
+        public:
+            // a copy continues independently from the same position
+            cursor(const cursor&) = default;
+            cursor& operator=(const cursor&) = default;
+
+            // copies up to n values into out, returns how many were copied (0 once the scan is done)
+            size_t next_batch(Comparable* out, size_t n) {
+                if (version != tree->_version) seek();
+
+                size_t count = 0;
+                while (count < n && !path.empty()) {
+                    const AVLNode* node = path.back();
+                    path.pop_back();
+                    out[count++] = node->value;
+                    descend_left(node->right);
+                }
+                if (count) last = out[count - 1];
+                return count;
+            }
+
+#if __cplusplus >= 202002L
+            size_t next_batch(std::span<Comparable> out) { return next_batch(out.data(), out.size()); }
+#endif
+
+            bool done() {
+                if (version != tree->_version) seek();
+                return path.empty();
+            }
+        };
+
+        // unpins a reader when destroyed
+        class read_guard {
+            friend class AVLTree;
+
+            std::atomic<uint64_t>* slot;
+
+            explicit read_guard(std::atomic<uint64_t>& slot) : slot{&slot} {}
+
+        public:
+            read_guard(read_guard&& other) noexcept : slot{other.slot} { other.slot = nullptr; }
+            read_guard& operator=(read_guard&&) = delete;
+            read_guard(const read_guard&) = delete;
+            read_guard& operator=(const read_guard&) = delete;
+            ~read_guard() { if (slot) slot->store(0); }
+        };
+
+        // owns a node detached from a tree, deleting it if it is never reinserted
+        class node_type {
+            friend class AVLTree;
+
+            AVLNode* node;
+
+            explicit node_type(AVLNode* node) : node{node} {}
+
+        public:
+            using value_type = Comparable;
+
+            node_type() : node{nullptr} {}
+            node_type(node_type&& other) noexcept : node{other.node} { other.node = nullptr; }
+            node_type& operator=(node_type&& rhs) noexcept {
+                if (this != &rhs) {
+                    delete node;
+                    node = rhs.node;
+                    rhs.node = nullptr;
+                }
+                return *this;
+            }
+            node_type(const node_type&) = delete;
+            node_type& operator=(const node_type&) = delete;
+            ~node_type() { delete node; }
+
+            [[nodiscard]] bool empty() const noexcept { return !node; }
+            explicit operator bool() const noexcept { return node; }
+
+            // the value may be modified before reinsertion
+            value_type& value() const {
+                if (!node) throw std::invalid_argument("The node handle is empty");
+                return node->value;
+            }
+        };
         
         class iterator {
+            friend class AVLTree;
         public:
-            using value_type        = AVLNode;
-            using difference_type   = ptrdiff_t;
-            using pointer           = AVLNode*;
-            using reference         = Comparable;
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type        = Comparable;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = const Comparable*;
+            using reference         = const Comparable&;
         private:
-            pointer ptr;
-            pointer max; // to allow --end()
+            AVLNode* ptr;
+            AVLNode* max; // to allow --end()
+
+            // position in the tree, size() for end()
+            difference_type index() const noexcept {
+                if (ptr) return static_cast<difference_type>(position(ptr));
+                return max ? static_cast<difference_type>(position(max)) + 1 : 0;
+            }
+
+            const AVLNode* top() const noexcept {
+                const AVLNode* node = ptr ? ptr : max;
+                while (node && node->parent) node = node->parent;
+                return node;
+            }
+
+            size_t tree_size() const noexcept { return count(top()); }
+
+            iterator& jump(difference_type target) noexcept {
+                ptr = select(const_cast<AVLNode*>(top()), static_cast<size_t>(target));
+                return *this;
+            }
 
         public:
             iterator() : ptr{nullptr}, max{nullptr} {}
-            iterator(pointer ptr, pointer max) : ptr{ptr}, max{max} {}
+            iterator(AVLNode* ptr, AVLNode* max) : ptr{ptr}, max{max} {}
 
             iterator& operator=(const iterator&) noexcept = default;
 
             [[nodiscard]] reference operator*() const noexcept { return ptr->value; }
-            [[nodiscard]] pointer operator->() const noexcept { return ptr; }
+            [[nodiscard]] pointer operator->() const noexcept { return &ptr->value; }
+
+            // on a node removed while a reader was pinned: the value is still readable but ++ and --
+            // lead to end(), so re-seek from the tree instead
+            [[nodiscard]] bool is_retired() const noexcept { return ptr && ptr->height == 0; }
 
             iterator& operator++() noexcept { 
                 if (!ptr) return *this;
@@ -339,61 +1612,49 @@ class AVLTree {
 
             iterator operator--(int) noexcept { iterator copy = *this; --(*this); return copy; }
 
+            // jumps take O(log n) through the subtree sizes and behave like repeated ++ and --:
+            // ++ stops at end(), -- from begin() wraps around to end() and then to the last value
             iterator& operator+=(difference_type offset) noexcept { 
-                for (difference_type i = 0; i < offset; i++) {
-                    ++(*this);
-                }
-                return *this;
+                if (offset <= 0) return *this;
+                const difference_type n = static_cast<difference_type>(tree_size());
+                const difference_type target = index() + offset;
+                return jump(target < n ? target : n);
             }
 
             [[nodiscard]] iterator operator+(difference_type offset) const noexcept {
                 iterator copy(*this);
-                for (difference_type i = 0; i < offset; i++) {
-                    ++(copy);
-                }
-                return copy;
+                return copy += offset;
             }
 
             iterator& operator-=(difference_type offset) noexcept { 
-                for (difference_type i = 0; i < offset; i++) {
-                    --(*this);
-                }
-                return *this;
+                if (offset <= 0) return *this;
+                const difference_type positions = static_cast<difference_type>(tree_size()) + 1; // end() included
+                return jump(((index() - offset) % positions + positions) % positions);
             }
 
             [[nodiscard]] iterator operator-(difference_type offset) const noexcept {
                 iterator copy(*this);
-                for (difference_type i = 0; i < offset; i++) {
-                    --(copy);
-                }
-                return copy;
+                return copy -= offset;
             }
 
             [[nodiscard]] difference_type operator-(const iterator& rhs) const noexcept {
                 // undefined behavior if this and rhs are not in the same tree
-                difference_type cnt = 0;
-                if (!rhs.ptr || !ptr) return cnt;
-
-                iterator copy(*this);
-                while (copy.ptr && copy.ptr->value < rhs.ptr->value) {
-                    cnt--;
-                    ++copy;
-                }
-
-                while (copy.ptr && copy.ptr->value > rhs.ptr->value) {
-                    cnt++;
-                    --copy;
-                }
-
-                return cnt;   
+                return index() - rhs.index();
             }
 
 
-            [[nodiscard]] bool operator==(const iterator& rhs) const noexcept { return (!rhs.ptr && !ptr) || (!(!rhs.ptr || !ptr) && (ptr->value == rhs.ptr->value)); }
-            [[nodiscard]] bool operator!=(const iterator& rhs) const noexcept { return !(rhs.ptr == ptr); }
+            // equal when they point at the same node, not at equal values
+            [[nodiscard]] bool operator==(const iterator& rhs) const noexcept { return ptr == rhs.ptr; }
+            [[nodiscard]] bool operator!=(const iterator& rhs) const noexcept { return !(*this == rhs); }
             [[nodiscard]] bool operator<(const iterator& rhs) const noexcept {  return !rhs.ptr || (ptr && ptr->value < rhs.ptr->value); }
             [[nodiscard]] bool operator>(const iterator& rhs) const noexcept {  return !rhs.ptr || (ptr && ptr->value > rhs.ptr->value); }
             [[nodiscard]] bool operator<=(const iterator& rhs) const noexcept { return !rhs.ptr || (ptr && ptr->value <= rhs.ptr->value); }
             [[nodiscard]] bool operator>=(const iterator& rhs) const noexcept { return !rhs.ptr || (ptr && ptr->value >= rhs.ptr->value); }
         };
+
+        struct insert_return_type {
+            iterator position;
+            bool inserted;
+            node_type node;
+        };
 };
@@ -0,0 +1,470 @@
+/*
+ *  Benchmarks for the AVL tree
+ *  usage: ./avl_bench [n]
+*/
+
+#include "avl.h"
+#include "sharded_avl.h"
+#include "dense_avl.h"
+#include "avl_wal.h"
+#include <chrono> // timing
+#include <random> // generate values to insert
+#include <vector>
+#include <algorithm> // std::shuffle, std::swap
+#include <cstdlib> // std::atoi
+#include <cstdio> // std::printf
+#include <thread> // throughput against thread count
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <string>
+#include <functional> // std::plus
+#include <unistd.h> // getpid
+
+using Clock = std::chrono::steady_clock;
+
+template <typename F>
+double time_ms(F&& f) {
+    Clock::time_point start = Clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// increasing keys with a few local swaps, like timestamps arriving slightly out of order
+std::vector<int> nearly_sorted(int n, std::mt19937& gen) {
+    std::vector<int> keys(n);
+    for (int i = 0; i < n; i++) keys[i] = i;
+    std::uniform_int_distribution<int> dist(0, n - 1);
+    for (int i = 0; i < n / 100; i++) {
+        int at = dist(gen);
+        if (at + 1 < n) std::swap(keys[at], keys[at + 1]);
+    }
+    return keys;
+}
+
+void insert_orders(int n, std::mt19937& gen) {
+    std::vector<int> sequential(n);
+    for (int i = 0; i < n; i++) sequential[i] = i;
+    std::vector<int> nearly = nearly_sorted(n, gen);
+    std::vector<int> random = sequential;
+    std::shuffle(random.begin(), random.end(), gen);
+
+    struct { const char* name; const std::vector<int>& keys; } orders[] = {
+        {"sequential", sequential}, {"nearly sorted", nearly}, {"random", random}
+    };
+
+    std::printf("insert order (n = %d)       insert    append_max   hint end()\n", n);
+    for (const auto& order : orders) {
+        AVLTree<int> a, b, c;
+        double plain = time_ms([&] { for (int key : order.keys) a.insert(key); });
+        double append = time_ms([&] { for (int key : order.keys) b.append_max(key); });
+        double hint = time_ms([&] { for (int key : order.keys) c.insert(c.end(), key); });
+        std::printf("  %-24s %9.1fms %10.1fms %10.1fms\n", order.name, plain, append, hint);
+    }
+}
+
+// single tree behind one reader/writer lock, the baseline for the sharded set
+struct LockedTree {
+    mutable std::shared_mutex lock;
+    AVLTree<int> tree;
+
+    LockedTree() : lock{}, tree{} {}
+    bool contains(int key) const { std::shared_lock<std::shared_mutex> reader(lock); return tree.contains(key); }
+    void insert(int key) { std::unique_lock<std::shared_mutex> writer(lock); tree.insert(key); }
+    void remove(int key) { std::unique_lock<std::shared_mutex> writer(lock); tree.remove(key); }
+};
+
+std::atomic<int> sink{0}; // keeps lookups from being optimized away
+
+// 80% lookups, 10% inserts, 10% removes over random keys, returns million operations per second
+template <typename Set>
+double mixed_throughput(Set& set, int n, int threads, int ops_per_thread) {
+    std::vector<std::thread> workers;
+    double ms = time_ms([&] {
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&set, n, t, ops_per_thread] {
+                std::mt19937 gen(t);
+                std::uniform_int_distribution<int> key(0, 2 * n);
+                std::uniform_int_distribution<int> op(0, 9);
+                int found = 0;
+                for (int i = 0; i < ops_per_thread; i++) {
+                    int k = key(gen);
+                    int o = op(gen);
+                    if (o == 0) set.insert(k);
+                    else if (o == 1) set.remove(k);
+                    else found += set.contains(k);
+                }
+                sink += found;
+            });
+        }
+        for (std::thread& worker : workers) worker.join();
+    });
+    return threads * static_cast<double>(ops_per_thread) / ms / 1000.0;
+}
+
+void sharded_throughput(int n) {
+    const int ops_per_thread = 200000;
+    std::vector<int> keys(n);
+    for (int i = 0; i < n; i++) keys[i] = 2 * i;
+
+    std::printf("\nmixed ops, Mops/s (n = %d, %u hardware threads)\n", n, std::thread::hardware_concurrency());
+    std::printf("  threads   locked tree   16 hash shards   16 range shards\n");
+    for (int threads = 1; threads <= 16; threads *= 2) {
+        LockedTree locked;
+        for (int key : keys) locked.tree.append_max(key);
+        ShardedAVLSet<int> hashed(16);
+        hashed.bulk_load(keys.begin(), keys.end());
+        ShardedAVLSet<int> ranged(16, ShardedAVLSet<int>::partition::range);
+        ranged.bulk_load(keys.begin(), keys.end());
+
+        double a = mixed_throughput(locked, n, threads, ops_per_thread);
+        double b = mixed_throughput(hashed, n, threads, ops_per_thread);
+        double c = mixed_throughput(ranged, n, threads, ops_per_thread);
+        std::printf("  %7d %13.2f %16.2f %17.2f\n", threads, a, b, c);
+    }
+}
+
+// full export of a tree: iterator walk against cursor batches
+void streaming_scan(int n, std::mt19937& gen) {
+    std::uniform_int_distribution<int> key;
+    AVLTree<int> tree;
+    for (int i = 0; i < n; i++) tree.insert(key(gen));
+
+    long long checksum = 0;
+    double iterated = time_ms([&] {
+        for (int value : tree) checksum += value;
+    });
+
+    std::vector<int> buffer(4096);
+    double batched = time_ms([&] {
+        auto cursor = tree.scan();
+        while (size_t count = cursor.next_batch(buffer.data(), buffer.size())) {
+            for (size_t i = 0; i < count; i++) checksum -= buffer[i];
+        }
+    });
+
+    std::printf("\nfull scan (n = %zu)\n", tree.size());
+    std::printf("  iterator   %8.1fms\n", iterated);
+    std::printf("  cursor     %8.1fms  (batches of %zu)\n", batched, buffer.size());
+    if (checksum != 0) std::printf("  scans disagree\n");
+}
+
+// write heavy workload under each balance policy: random inserts, then removes and inserts in equal parts
+template <typename Balance>
+void balance_policy(const char* name, const std::vector<int>& keys) {
+    AVLTree<int, Balance> tree;
+    double inserts = time_ms([&] {
+        for (int key : keys) tree.insert(key);
+    });
+    const size_t insert_rotations = tree.rotation_count();
+
+    double churn = time_ms([&] {
+        for (size_t i = 0; i < keys.size(); i++) {
+            tree.remove(keys[i]);
+            tree.insert(keys[i] ^ 1);
+        }
+    });
+
+    std::printf("  %-12s %8.1fms %10zu   %8.1fms %10zu\n", name, inserts, insert_rotations, churn, tree.rotation_count() - insert_rotations);
+}
+
+void balance_policies(int n, std::mt19937& gen) {
+    std::uniform_int_distribution<int> key;
+    std::vector<int> keys(n);
+    for (int& k : keys) k = key(gen);
+
+    std::printf("\nbalance policies (n = %d)\n", n);
+    std::printf("  %-12s %10s %10s   %10s %10s\n", "policy", "insert", "rotations", "churn", "rotations");
+    balance_policy<AVLStrict>("strict", keys);
+    balance_policy<AVLRelaxed<2>>("relaxed<2>", keys);
+    balance_policy<AVLRelaxed<4>>("relaxed<4>", keys);
+    balance_policy<AVLRankBalanced>("rank (WAVL)", keys);
+}
+
+// memory and lookup time per key for 64 bit ids, in plain tree nodes and in dense blocks
+void dense_keys_case(const char* name, const std::vector<uint64_t>& keys, const std::vector<uint64_t>& probes) {
+    AVLTree<uint64_t> tree;
+    DenseAVLSet<uint64_t> dense;
+    for (uint64_t key : keys) {
+        tree.insert(key);
+        dense.insert(key);
+    }
+
+    size_t found = 0;
+    double tree_lookup = time_ms([&] {
+        for (uint64_t probe : probes) found += tree.contains(probe);
+    });
+    double dense_lookup = time_ms([&] {
+        for (uint64_t probe : probes) found -= dense.contains(probe);
+    });
+
+    std::printf("  %-10s %12.1f %12.1f %12.1f %12.1f\n", name,
+                double(tree.bytes_used()) / tree.size(), double(dense.bytes_used()) / dense.size(),
+                tree_lookup * 1e6 / probes.size(), dense_lookup * 1e6 / probes.size());
+    if (found != 0) std::printf("  lookups disagree\n");
+}
+
+void dense_keys(int n, std::mt19937& gen) {
+    std::mt19937_64 wide(gen());
+    std::vector<uint64_t> dense(n), sparse(n), clustered(n);
+    for (int i = 0; i < n; i++) {
+        dense[i] = 1000000 + i;
+        sparse[i] = wide();
+        // runs of about 1000 ids a few million apart
+        clustered[i] = (wide() % (n / 1000 + 1)) * 4000000 + wide() % 1500;
+    }
+    std::shuffle(dense.begin(), dense.end(), gen);
+
+    std::printf("\ninteger keys (n = %d)\n", n);
+    std::printf("  %-10s %12s %12s %12s %12s\n", "keys", "tree B/key", "dense B/key", "tree ns", "dense ns");
+    for (const auto& keys : {std::make_pair("dense", &dense), std::make_pair("sparse", &sparse), std::make_pair("clustered", &clustered)}) {
+        // half hits, half misses nearby
+        std::vector<uint64_t> probes;
+        for (int i = 0; i < n; i++) probes.push_back((*keys.second)[gen() % n] + (i % 2));
+        dense_keys_case(keys.first, *keys.second, probes);
+    }
+}
+
+// group commit: write throughput against records per fsync, and recovery time from the log and from a snapshot
+void durability(int n, std::mt19937& gen) {
+    const std::string path = "/tmp/avl_bench_" + std::to_string(::getpid());
+    auto erase_files = [&] {
+        for (const char* suffix : {".log", ".snapshot", ".snapshot.tmp"}) std::remove((path + suffix).c_str());
+    };
+    std::uniform_int_distribution<int> key;
+    std::vector<int> keys(n);
+    for (int& k : keys) k = key(gen);
+
+    std::printf("\ndurable inserts, 2000 records\n");
+    for (size_t group : {1, 16, 256}) {
+        erase_files();
+        DurableAVLTree<int> tree(path, AVLDurability{group, 0});
+        double ms = time_ms([&] {
+            for (int i = 0; i < 2000; i++) tree.insert(keys[i]);
+            tree.commit();
+        });
+        std::printf("  %4zu per fsync %10.0f records/s\n", group, 2000 / ms * 1000);
+    }
+
+    std::printf("\nrecovery (n = %d)\n", n);
+    struct { const char* name; int logged; } layouts[] = {{"log only", n}, {"half snapshot", n / 2}, {"snapshot only", 0}};
+    for (const auto& layout : layouts) {
+        erase_files();
+        {
+            DurableAVLTree<int> tree(path, AVLDurability{4096, 0});
+            for (int i = 0; i < n - layout.logged; i++) tree.insert(keys[i]);
+            tree.snapshot();
+            for (int i = n - layout.logged; i < n; i++) tree.insert(keys[i]);
+        }
+        size_t recovered = 0;
+        double ms = time_ms([&] {
+            DurableAVLTree<int> tree(path);
+            recovered = tree.size();
+        });
+        std::printf("  %-14s %8.1fms  (%zu values)\n", layout.name, ms, recovered);
+    }
+    erase_files();
+}
+
+// in order scan of a tree built by random inserts, before and after compact() lays the nodes out in order
+void compacted_scan(int n, std::mt19937& gen) {
+    std::uniform_int_distribution<int> key;
+    AVLTree<int> tree;
+    for (int i = 0; i < n; i++) tree.insert(key(gen));
+
+    long long checksum = 0;
+    double scattered = time_ms([&] {
+        for (int value : tree) checksum += value;
+    });
+    const size_t before = tree.bytes_reserved();
+
+    double compacting = time_ms([&] { tree.compact(); });
+    double dense = time_ms([&] {
+        for (int value : tree) checksum -= value;
+    });
+
+    std::printf("\nnode layout (n = %zu, %zu bytes used)\n", tree.size(), tree.bytes_used());
+    std::printf("  scattered  %8.1fms  (%zu bytes reserved)\n", scattered, before);
+    std::printf("  compacted  %8.1fms  (%zu bytes reserved, compact took %.1fms)\n", dense, tree.bytes_reserved(), compacting);
+    if (checksum != 0) std::printf("  scans disagree\n");
+}
+
+// counting the values in random ranges through subtree sizes against walking the range
+void range_counts(int n, std::mt19937& gen) {
+    std::uniform_int_distribution<int> key;
+    AVLTree<int> tree;
+    for (int i = 0; i < n; i++) tree.insert(key(gen));
+
+    const int queries = 200;
+    std::vector<std::pair<int, int>> ranges(queries);
+    for (auto& [lo, hi] : ranges) {
+        lo = key(gen);
+        hi = lo + key(gen) % (1 << 28); // about 1/8 of the values
+        if (hi < lo) hi = lo;
+    }
+
+    size_t counted = 0, walked = 0;
+    double by_size = time_ms([&] {
+        for (auto [lo, hi] : ranges) counted += tree.count_between(lo, hi);
+    });
+    double by_walk = time_ms([&] {
+        for (auto [lo, hi] : ranges) {
+            for (auto it = tree.lower_bound(lo); it != tree.end() && *it < hi; ++it) walked++;
+        }
+    });
+    std::mt19937_64 rng(gen());
+    double sampling = time_ms([&] {
+        for (int i = 0; i < queries; i++) counted += tree.sample(16, rng).size() - 16;
+    });
+    long long checksum = 0;
+    double quantiles = time_ms([&] {
+        for (int i = 0; i < queries; i++) checksum += tree.quantile(i / double(queries));
+    });
+
+    std::printf("\nrange queries (n = %zu, %d queries)\n", tree.size(), queries);
+    std::printf("  count_between  %8.2fms\n", by_size);
+    std::printf("  iterator walk  %8.2fms\n", by_walk);
+    std::printf("  sample(16)     %8.2fms\n", sampling);
+    std::printf("  quantile       %8.2fms  (checksum %lld)\n", quantiles, checksum);
+    if (counted != walked) std::printf("  counts disagree\n");
+}
+
+// parallel_reduce and parallel_for_each from 1 to 64 threads against a sequential walk
+// (the default n keeps memory small, 10^8 values need about 6GB of nodes)
+void parallel_scaling(int n, std::mt19937& gen) {
+    std::uniform_int_distribution<int> key;
+    AVLTree<int> tree;
+    for (int i = 0; i < n; i++) tree.insert(key(gen));
+    tree.compact();
+
+    long long expected = 0;
+    double sequential = time_ms([&] {
+        for (int value : tree) expected += value;
+    });
+    std::printf("\nparallel traversal (n = %zu, %u hardware threads)\n", tree.size(), std::thread::hardware_concurrency());
+    std::printf("  sequential            %8.1fms\n", sequential);
+
+    tree.parallel_reduce(0LL, std::plus<long long>()); // warm up
+    for (unsigned threads = 1; threads <= 64; threads *= 2) {
+        long long sum = 0;
+        double reduce = time_ms([&] { sum = tree.parallel_reduce(0LL, std::plus<long long>(), threads); });
+        std::atomic<long long> visited{0};
+        double for_each = time_ms([&] {
+            tree.parallel_for_each([&](int value) { if (value % 1024 == 0) visited++; }, threads);
+        });
+        std::printf("  %2u threads  reduce %8.1fms  for_each %8.1fms\n", threads, reduce, for_each);
+        if (sum != expected) std::printf("  sums disagree\n");
+    }
+}
+
+// lookups, inserts and removes following a random walk over the keys (steps of up to +-16),
+// searching from the root against searching from the previous call's node
+void finger_search(int n, std::mt19937& gen) {
+    std::uniform_int_distribution<int> step(-16, 16);
+    std::vector<int> trace(n);
+    int key = n;
+    for (int& value : trace) {
+        key += step(gen);
+        if (key < 0) key = -key;
+        value = key;
+    }
+
+    AVLTree<int> tree, fingered;
+    for (int i = 0; i < 2 * n; i += 2) {
+        tree.insert(i);
+        fingered.insert(i);
+    }
+    tree.compact();
+    fingered.compact();
+
+    size_t found = 0, found_near = 0;
+    double lookups = time_ms([&] { for (int value : trace) found += tree.contains(value); });
+    double lookups_near = time_ms([&] { for (int value : trace) found_near += fingered.find_near(value) != fingered.end(); });
+
+    double inserts = time_ms([&] { for (int value : trace) tree.insert(value | 1); });
+    double inserts_near = time_ms([&] { for (int value : trace) fingered.insert_near(value | 1); });
+
+    double removes = time_ms([&] { for (int value : trace) tree.remove(value); });
+    double removes_near = time_ms([&] { for (int value : trace) fingered.remove_near(value); });
+
+    std::printf("\nlocal access trace (n = %d, steps of up to 16)\n", n);
+    std::printf("  %-8s  from root %8.1fms  finger %8.1fms\n", "lookup", lookups, lookups_near);
+    std::printf("  %-8s  from root %8.1fms  finger %8.1fms\n", "insert", inserts, inserts_near);
+    std::printf("  %-8s  from root %8.1fms  finger %8.1fms\n", "remove", removes, removes_near);
+    if (found != found_near || tree.size() != fingered.size()) std::printf("  results disagree\n");
+}
+
+#ifdef AVL_HAS_COROUTINES
+// a request probing many different trees: sequential contains against interleaved co_contains
+void interleaved_lookups(std::mt19937& gen) {
+    const int tree_count = 16;
+    const int probes = 200000;
+    const int request = 64; // lookups issued together
+    const int widths[] = {1, 4, 8, 16, 32};
+
+    std::printf("\nlookups across %d trees, ns per lookup\n", tree_count);
+    std::printf("  keys per tree   sequential");
+    for (int width : widths) std::printf("   width %2d", width);
+    std::printf("\n");
+
+    for (int keys_per_tree : {1 << 10, 1 << 14, 1 << 17}) {
+        std::uniform_int_distribution<int> key(0, 4 * keys_per_tree);
+        std::vector<AVLTree<int>> trees(tree_count);
+        for (AVLTree<int>& tree : trees) {
+            for (int i = 0; i < keys_per_tree; i++) tree.insert(key(gen));
+        }
+
+        std::uniform_int_distribution<int> which(0, tree_count - 1);
+        std::vector<std::pair<int, int>> targets(probes);
+        for (auto& target : targets) target = {which(gen), key(gen)};
+
+        int expected = 0;
+        double sequential = time_ms([&] {
+            for (const auto& target : targets) expected += trees[target.first].contains(target.second);
+        });
+        std::printf("  %13d %12.1f", keys_per_tree, sequential * 1e6 / probes);
+
+        bool agree = true;
+        for (int width : widths) {
+            int hits = 0;
+            double interleaved = time_ms([&] {
+                std::vector<AVLLookup<bool>> lookups;
+                lookups.reserve(request);
+                for (int start = 0; start < probes; start += request) {
+                    AVLScheduler scheduler(width);
+                    for (int i = start; i < start + request && i < probes; i++) {
+                        lookups.push_back(trees[targets[i].first].co_contains(targets[i].second));
+                        scheduler.add(lookups.back());
+                    }
+                    scheduler.run();
+                    for (const AVLLookup<bool>& lookup : lookups) hits += lookup.result();
+                    lookups.clear();
+                }
+            });
+            std::printf(" %10.1f", interleaved * 1e6 / probes);
+            agree = agree && hits == expected;
+        }
+        std::printf("\n");
+        if (!agree) std::printf("  lookups disagree\n");
+    }
+}
+#endif
+
+int main(int argc, char** argv) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    std::mt19937 gen(42);
+
+    insert_orders(n, gen);
+    sharded_throughput(n);
+    balance_policies(n, gen);
+    streaming_scan(n, gen);
+    compacted_scan(n, gen);
+    range_counts(n, gen);
+    parallel_scaling(n, gen);
+    finger_search(n, gen);
+    dense_keys(n, gen);
+    durability(n, gen);
+#ifdef AVL_HAS_COROUTINES
+    interleaved_lookups(gen);
+#endif
+}
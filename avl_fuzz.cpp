@@ -0,0 +1,123 @@
+/*
+ *  Fuzz target: every input byte pair is an operation on a small AVLTree, checked against std::set
+ *  libFuzzer:  clang++ -std=c++20 -g -O1 -fsanitize=fuzzer,address,undefined avl_fuzz.cpp
+ *  standalone: g++ -std=c++20 -DAVL_FUZZ_STANDALONE avl_fuzz.cpp && ./a.out [files...]
+ *              replays the given inputs, or random ones without arguments
+*/
+
+#include "avl.h"
+#include <set>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio> // std::printf
+#include <cstdlib> // std::abort
+
+#define check(X) if (!(X)) {\
+  std::printf("  [fail] (%s:%d) %s\n", __FILE__, __LINE__, #X);\
+  std::abort();\
+}
+
+// runs one input on a tree with the given balance policy
+template <typename Balance>
+void run(const uint8_t* data, size_t size) {
+    AVLTree<int, Balance> tree, other;
+    std::set<int> expected;
+
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        const int value = data[i + 1] % 64; // a small key space so ops keep hitting existing values
+        switch (data[i] % 8) {
+            case 0:
+                tree.insert(value);
+                expected.insert(value);
+                break;
+            case 1:
+                check(*tree.insert_near(value) == value);
+                expected.insert(value);
+                break;
+            case 2:
+                if (data[i] & 8) tree.remove_near(value);
+                else tree.remove(value);
+                expected.erase(value);
+                break;
+            case 3:
+                if (data[i] & 8) {
+                    check((tree.find_near(value) != tree.end()) == (expected.count(value) == 1));
+                }
+                else {
+                    check(tree.contains(value) == (expected.count(value) == 1));
+                }
+                break;
+            case 4: {
+                auto it = tree.upper_bound(value);
+                auto reference = expected.upper_bound(value);
+                check((it == tree.end()) == (reference == expected.end()));
+                if (reference != expected.end()) check(*it == *reference);
+                break;
+            }
+            case 5: {
+                // round trip through a node handle
+                auto handle = tree.extract(value);
+                check(handle.empty() == (expected.count(value) == 0));
+                if (!handle.empty()) other.insert(std::move(handle));
+                tree.merge(other);
+                break;
+            }
+            case 6:
+                tree.insert(tree.lower_bound(value), value);
+                expected.insert(value);
+                break;
+            case 7:
+                if (value < 8) tree.compact();
+                else if (value < 16) tree.reserve(value * 4);
+                else if (value < 17) {
+                    tree.clear();
+                    expected.clear();
+                }
+                break;
+        }
+        check(tree.validate());
+    }
+
+    check(tree.size() == expected.size());
+    check(std::vector<int>(tree.begin(), tree.end()) == std::vector<int>(expected.begin(), expected.end()));
+    check(std::vector<int>(tree.rbegin(), tree.rend()) == std::vector<int>(expected.rbegin(), expected.rend()));
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // the first byte picks the balance policy
+    if (size == 0) return 0;
+    switch (data[0] % 3) {
+        case 0: run<AVLStrict>(data + 1, size - 1); break;
+        case 1: run<AVLRelaxed<2>>(data + 1, size - 1); break;
+        case 2: run<AVLRankBalanced>(data + 1, size - 1); break;
+    }
+    return 0;
+}
+
+#ifdef AVL_FUZZ_STANDALONE
+#include <fstream>
+#include <iterator>
+#include <random>
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            std::ifstream file(argv[i], std::ios::binary);
+            std::vector<uint8_t> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+        }
+        return 0;
+    }
+
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::uniform_int_distribution<size_t> length(0, 4096);
+    for (int run = 0; run < 2000; run++) {
+        std::vector<uint8_t> input(length(gen));
+        for (uint8_t& b : input) b = static_cast<uint8_t>(byte(gen));
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+    std::printf("2000 random inputs passed\n");
+}
+#endif
@@ -0,0 +1,265 @@
+/*
+ *  Randomized differential stress test: AVLTree and ShardedAVLSet against std::set,
+ *  plus readers pinned under deferred reclamation
+ *  usage: ./avl_stress [ops per run] [seed]
+ *  Build it at -O2 for volume, or with sanitizers (see the Makefile stress targets).
+*/
+
+#include "avl.h"
+#include "sharded_avl.h"
+#include <set>
+#include <random>
+#include <vector>
+#include <thread>
+#include <mutex> // pinned readers
+#include <shared_mutex>
+#include <atomic>
+#include <chrono> // ops per second
+#include <cstdio> // std::printf
+#include <cstdlib> // std::abort, std::strtoull
+#include <iterator> // std::distance
+
+#define check(X) if (!(X)) {\
+  std::printf("  [fail] (%s:%d) seed %llu: %s\n", __FILE__, __LINE__, seed, #X);\
+  std::abort();\
+}
+
+using Clock = std::chrono::steady_clock;
+
+// mixed inserts, removes, lookups, finger searches, bounds, range counts, node handle moves and iteration on one tree,
+// compared with std::set after every op and validated every few thousand ops
+template <typename Balance>
+void single_threaded(const char* name, size_t ops, unsigned long long seed, int key_range) {
+    std::mt19937_64 gen(seed);
+    std::uniform_int_distribution<int> key(0, key_range - 1);
+    std::uniform_int_distribution<int> pick(0, 99);
+
+    AVLTree<int, Balance> tree, other;
+    std::set<int> expected, other_expected;
+    tree.reserve(key_range / 4);
+
+    // the O(n) checks come about once per n ops, so their cost stays constant per op
+    const size_t every = key_range / 8;
+    Clock::time_point start = Clock::now();
+    for (size_t op = 0; op < ops; op++) {
+        const int value = key(gen);
+        const int what = pick(gen);
+
+        if (what < 35) {
+            tree.insert(value);
+            expected.insert(value);
+        }
+        else if (what < 60) {
+            tree.remove(value);
+            expected.erase(value);
+        }
+        else if (what < 72) {
+            check(tree.contains(value) == (expected.count(value) == 1));
+        }
+        else if (what < 76) {
+            check((tree.find_near(value) != tree.end()) == (expected.count(value) == 1));
+        }
+        else if (what < 78) {
+            check(*tree.insert_near(value) == value);
+            expected.insert(value);
+        }
+        else if (what < 80) {
+            tree.remove_near(value);
+            expected.erase(value);
+        }
+        else if (what < 88) {
+            auto it = tree.lower_bound(value);
+            auto reference = expected.lower_bound(value);
+            check((it == tree.end()) == (reference == expected.end()));
+            if (reference != expected.end()) check(*it == *reference);
+        }
+        else if (what < 92) {
+            // moves a value to the other tree and sometimes back
+            auto handle = tree.extract(value);
+            check(handle.empty() == (expected.erase(value) == 0));
+            if (!handle.empty()) {
+                other.insert(std::move(handle));
+                other_expected.insert(value);
+            }
+            if (what == 91) {
+                // values already in tree stay behind in other
+                tree.merge(other);
+                std::set<int> stays;
+                for (int moved : other_expected) {
+                    if (!expected.insert(moved).second) stays.insert(moved);
+                }
+                check(std::vector<int>(other.begin(), other.end()) == std::vector<int>(stays.begin(), stays.end()));
+                other.clear();
+                other_expected.clear();
+            }
+        }
+        else if (what < 96) {
+            tree.insert(tree.lower_bound(value), value);
+            expected.insert(value);
+        }
+        else if (what < 98) {
+            if (!expected.empty()) {
+                check(tree.find_min() == *expected.begin());
+                check(tree.find_max() == *expected.rbegin());
+            }
+            // a short range every time and a wide one now and then, so the std::set side stays cheap
+            const int hi = value + (op % 64 == 0 ? key_range / 64 : 32);
+            check(tree.count_between(value, hi) == size_t(std::distance(expected.lower_bound(value), expected.lower_bound(hi))));
+        }
+        else if (op % every == 0) {
+            // full comparison both ways, plus compaction now and then
+            check(tree.size() == expected.size());
+            auto reference = expected.begin();
+            for (int v : tree) check(v == *reference++);
+            auto backwards = expected.rbegin();
+            for (auto it = tree.rbegin(); it != tree.rend(); ++it) check(*it == *backwards++);
+            if (what == 99) tree.compact();
+        }
+
+        if (op % (64 * every) == 0) {
+            check(tree.validate());
+            check(other.validate());
+            check(tree.size() == expected.size());
+        }
+    }
+    check(tree.validate());
+    check(std::vector<int>(tree.begin(), tree.end()) == std::vector<int>(expected.begin(), expected.end()));
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::printf("  %-22s %10zu ops %8.2f Mops/s\n", name, ops, ops / seconds / 1e6);
+}
+
+// threads insert and remove their own keys (key % threads == thread) while reading everyone's
+// and every thread keeps a std::set of its keys, which together must equal the shared set
+void multi_threaded(size_t ops, unsigned long long seed, int threads) {
+    const int key_range = 1 << 16;
+    ShardedAVLSet<int> shared(8, ShardedAVLSet<int>::partition::range);
+    std::vector<std::set<int>> owned(threads);
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 gen(seed + t);
+            std::uniform_int_distribution<int> key(0, key_range / threads - 1);
+            std::uniform_int_distribution<int> pick(0, 9);
+            std::set<int>& mine = owned[t];
+            for (size_t op = 0; op < ops / threads; op++) {
+                const int value = key(gen) * threads + t;
+                const int what = pick(gen);
+                if (what < 4) {
+                    shared.insert(value);
+                    mine.insert(value);
+                }
+                else if (what < 7) {
+                    shared.remove(value);
+                    mine.erase(value);
+                }
+                else {
+                    // only this thread changes its own keys, so the answer is known
+                    check(shared.contains(value) == (mine.count(value) == 1));
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) worker.join();
+
+    std::set<int> expected;
+    for (const std::set<int>& mine : owned) expected.insert(mine.begin(), mine.end());
+    std::vector<int> values;
+    shared.for_each([&](int value) { values.push_back(value); });
+    check(shared.size() == expected.size());
+    check(values == std::vector<int>(expected.begin(), expected.end()));
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::printf("  sharded, %2d threads    %10zu ops %8.2f Mops/s\n", threads, ops, ops / seconds / 1e6);
+}
+
+// one writer changes a tree under a mutex while readers pinned with deferred reclamation walk
+// iterators between their own locked steps, re-seeking past removed nodes; every walk must see
+// increasing values in range
+void pinned_readers(size_t ops, unsigned long long seed, int readers) {
+    const int key_range = 1 << 12;
+    AVLTree<int> tree;
+    tree.enable_deferred_reclamation();
+    std::shared_mutex lock;
+    std::atomic<bool> done{false};
+    std::atomic<size_t> steps{0};
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < readers; t++) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 gen(seed + t);
+            std::uniform_int_distribution<int> key(0, key_range - 1);
+            size_t walked = 0;
+            while (!done) {
+                auto guard = tree.pin();
+                std::shared_lock<std::shared_mutex> step(lock);
+                auto it = tree.lower_bound(key(gen));
+                step.unlock();
+                int previous = -1;
+                for (int i = 0; i < 64; i++) {
+                    step.lock();
+                    const bool end = it == tree.end();
+                    if (!end) {
+                        const int value = *it;
+                        check(value > previous && value < key_range);
+                        previous = value;
+                        // the writer may have removed it since the last step
+                        if (it.is_retired()) it = tree.upper_bound(value);
+                        else ++it;
+                    }
+                    step.unlock();
+                    if (end) break;
+                    walked++;
+                    std::this_thread::yield(); // let the writer in between steps
+                }
+            }
+            steps += walked;
+        });
+    }
+
+    std::mt19937_64 gen(seed);
+    std::uniform_int_distribution<int> key(0, key_range - 1);
+    std::set<int> expected;
+    for (size_t op = 0; op < ops; op++) {
+        const int value = key(gen);
+        std::unique_lock<std::shared_mutex> writer(lock);
+        if (op % 2) {
+            tree.insert(value);
+            expected.insert(value);
+        }
+        else {
+            tree.remove(value);
+            expected.erase(value);
+        }
+        if (op % 4096 == 0) check(tree.validate());
+        writer.unlock();
+        if (op % 256 == 0) std::this_thread::yield(); // and the readers in now and then
+    }
+    done = true;
+    for (std::thread& worker : workers) worker.join();
+
+    tree.reclaim();
+    check(tree.reclamation_status().retired_nodes == 0);
+    check(tree.validate());
+    check(std::vector<int>(tree.begin(), tree.end()) == std::vector<int>(expected.begin(), expected.end()));
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::printf("  pinned, %2d readers     %10zu ops %8.2f Mops/s (%zu reader steps)\n", readers, ops, ops / seconds / 1e6, steps.load());
+}
+
+int main(int argc, char** argv) {
+    const size_t ops = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    const unsigned long long seed = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1;
+
+    std::printf("stress (seed %llu)\n", seed);
+    single_threaded<AVLStrict>("strict, 512 keys", ops, seed, 512);
+    single_threaded<AVLStrict>("strict", ops, seed, 1 << 12);
+    single_threaded<AVLRelaxed<3>>("relaxed<3>", ops, seed, 1 << 12);
+    single_threaded<AVLRankBalanced>("rank balanced", ops, seed, 1 << 12);
+    single_threaded<AVLStrict>("strict, 64k keys", ops / 4, seed, 1 << 16);
+    for (int threads : {2, 8}) multi_threaded(ops / 4, seed, threads);
+    pinned_readers(ops / 4, seed, 3);
+}
@@ -1,8 +1,30 @@
 #include "avl.h"
+#include "interval_tree.h"
+#include "sharded_avl.h"
+#include "static_avl.h"
+#include "dense_avl.h"
+#include "avl_wal.h"
 #include <sstream> // visualization test
 #include <random> // generate values to insert
 #include <unordered_map> // used to keep track of the values generated to insert
 #include <algorithm> // to randomly select a single node to remove from the map (using sample)
+#include <string> // const iterator test
+#include <type_traits> // std::is_same_v
+#include <thread> // concurrent sharded inserts, concurrent readers
+#include <shared_mutex> // concurrent readers
+#include <atomic> // concurrent readers
+#include <set> // reference for balance policies
+#include <cstdlib> // std::abs
+#include <cstdio> // std::remove
+#include <fstream> // damaging log files
+#include <unistd.h> // getpid
+#include <sys/resource.h> // failing log writes
+#include <csignal> // SIGXFSZ
+#include <cmath> // std::ceil
+#include <functional> // std::greater_equal
+#if __cplusplus >= 202002L
+#include <ranges> // ranges integration test
+#endif
 
 using std::cout, std::endl;
 
@@ -584,9 +606,1202 @@ int main() {
         it2 -= 3;
         expect(*it2 to_be intTree.getRoot()->left->left->value);
 
+        // iterators are equal when they point at the same node, not at equal values
+        AVLTree<int> copy = intTree;
+        expect((copy.begin() == intTree.begin()) to_be false);
+        expect((copy.begin() != intTree.begin()) to_be true);
+        expect((intTree.begin() + 4 == intTree.lower_bound(10)) to_be true);
+        expect((intTree.begin() != intTree.end()) to_be true);
+        expect((copy.end() == intTree.end()) to_be true);
+
+    }
+
+
+
+    // extract / insert node handle / merge
+    {
+        AVLTree<int> pending;
+        AVLTree<int> committed;
+        for (int i = 1; i <= 7; i++) pending.insert(i);
+
+        auto node = pending.extract(4);
+        expect(node.empty() to_be false);
+        expect(node.value() to_be 4);
+        expect(pending.size() to_be 6);
+        expect(pending.contains(4) to_be false);
+        expect(pending.extract(4).empty() to_be true);
+
+        auto result = committed.insert(std::move(node));
+        expect(result.inserted to_be true);
+        expect(*result.position to_be 4);
+        expect(result.node.empty() to_be true);
+        expect(node.empty() to_be true);
+        expect(committed.size() to_be 1);
+        expect(committed.contains(4) to_be true);
+
+        // extract the min and max through iterators
+        committed.insert(pending.extract(pending.begin()));
+        committed.insert(pending.extract(pending.end() - 1));
+        expect(pending.find_min() to_be 2);
+        expect(pending.find_max() to_be 6);
+        expect(committed.find_min() to_be 1);
+        expect(committed.find_max() to_be 7);
+
+        // a duplicate is handed back
+        committed.insert(5);
+        auto dupe = committed.insert(pending.extract(5));
+        expect(dupe.inserted to_be false);
+        expect(dupe.node.value() to_be 5);
+        expect(*dupe.position to_be 5);
+
+        // the value may be changed while detached
+        dupe.node.value() = 10;
+        committed.insert(std::move(dupe.node));
+        expect(committed.find_max() to_be 10);
+
+        // merge leaves values already in the target behind
+        pending.insert(10);
+        committed.merge(pending);
+        expect(pending.size() to_be 1);
+        expect(pending.contains(10) to_be true);
+        expect(committed.size() to_be 8);
+
+        std::vector<int> values;
+        for (int n : committed) values.push_back(n);
+        expect(values to_be (std::vector<int>{1, 2, 3, 4, 5, 6, 7, 10}));
+
+        std::vector<int> rev;
+        for (auto it = committed.end() - 1; it >= committed.begin(); it--) rev.push_back(*it);
+        expect(rev to_be (std::vector<int>{10, 7, 6, 5, 4, 3, 2, 1}));
+
+        // a copy has its own parent links, so extracting from it leaves the original intact
+        AVLTree<int> copy = committed;
+        expect(copy.size() to_be 8);
+        copy.extract(4);
+        copy.remove(2);
+        expect(committed.contains(4) to_be true);
+        expect(committed.getRoot()->parent to_be nullptr);
+        values.clear();
+        for (int n : copy) values.push_back(n);
+        expect(values to_be (std::vector<int>{1, 3, 5, 6, 7, 10}));
+    }
+
+    // hint insert / append_max
+    {
+        AVLTree<int> intTree;
+        for (int i = 0; i < 1000; i++) intTree.append_max(i * 2);
+        expect(intTree.size() to_be 1000);
+        expect(intTree.find_min() to_be 0);
+        expect(intTree.find_max() to_be 1998);
+        // an AVL tree of 1000 nodes is at most 1.44 * log2(1000) high
+        expect(intTree.getRoot()->height <= 14);
+
+        // out of order values fall back to a normal insert
+        intTree.append_max(1);
+        intTree.append_max(1998);
+        expect(intTree.size() to_be 1001);
+        expect(intTree.contains(1) to_be true);
+
+        // correct hints
+        auto it = intTree.insert(intTree.end(), 2000);
+        expect(*it to_be 2000);
+        it = intTree.insert(intTree.begin(), -1);
+        expect(*it to_be -1);
+        expect(intTree.find_min() to_be -1);
+        it = intTree.insert(intTree.begin() + 4, 5);
+        expect(*it to_be 5);
+        expect(*(it - 1) to_be 4);
+        expect(*(it + 1) to_be 6);
+
+        // wrong hints and duplicates
+        it = intTree.insert(intTree.begin(), 7);
+        expect(*it to_be 7);
+        it = intTree.insert(intTree.end(), 8);
+        expect(*it to_be 8);
+        expect(intTree.size() to_be 1005);
+
+        AVLTree<int> empty;
+        it = empty.insert(empty.end(), 3);
+        expect(*it to_be 3);
+        expect(empty.size() to_be 1);
+
+        std::vector<int> values;
+        for (int n : intTree) values.push_back(n);
+        expect(std::is_sorted(values.begin(), values.end()) to_be true);
+        expect(values.size() to_be 1005u);
+    }
+
+    // const iterators / reverse iterators / standard algorithms
+    {
+        AVLTree<std::string> words;
+        words.insert("pear");
+        words.insert("apple");
+        words.insert("fig");
+        words.insert("kiwi");
+        const AVLTree<std::string>& view = words;
+
+        // dereferencing refers to the stored value instead of copying it
+        static_assert(std::is_same_v<decltype(*view.begin()), const std::string&>);
+        static_assert(std::is_same_v<AVLTree<std::string>::iterator::value_type, std::string>);
+        expect(&*view.begin() to_be &*view.cbegin());
+        expect(view.begin()->size() to_be 5u);
+
+        std::vector<std::string> fwd(view.cbegin(), view.cend());
+        expect(fwd to_be (std::vector<std::string>{"apple", "fig", "kiwi", "pear"}));
+        std::vector<std::string> rev(view.rbegin(), view.rend());
+        expect(rev to_be (std::vector<std::string>{"pear", "kiwi", "fig", "apple"}));
+        expect(*view.crbegin() to_be "pear");
+
+        expect(std::find(view.begin(), view.end(), "kiwi") not_to_be view.end());
+        expect(std::find(view.begin(), view.end(), "plum") to_be view.end());
+        expect(std::distance(view.begin(), view.end()) to_be 4);
+        expect(view.end() - view.begin() to_be 4);
+        expect(view.begin() - view.end() to_be -4);
+        expect(view.end() - (view.begin() + 1) to_be 3);
+
+        AVLTree<int> empty;
+        expect(empty.begin() to_be empty.end());
+        expect(empty.rbegin() to_be empty.rend());
+        int visited = 0;
+        for (int n : empty) visited += n + 1;
+        expect(visited to_be 0);
+
+#if __cplusplus >= 202002L
+        static_assert(std::bidirectional_iterator<AVLTree<std::string>::const_iterator>);
+        static_assert(std::ranges::bidirectional_range<const AVLTree<std::string>>);
+
+        expect(std::ranges::count_if(view, [](const std::string& w) { return w.size() == 4; }) to_be 2);
+        std::vector<std::size_t> lengths;
+        for (std::size_t n : view | std::views::reverse | std::views::transform(&std::string::size)) lengths.push_back(n);
+        expect(lengths to_be (std::vector<std::size_t>{4, 4, 3, 5}));
+        expect(*std::ranges::lower_bound(view, std::string("banana")) to_be "fig");
+#endif
+    }
+
+    // interval tree
+    {
+        IntervalTree<int> reservations;
+        reservations.insert(10, 20);
+        reservations.insert(5, 8);
+        reservations.insert(15, 40);
+        reservations.insert(30, 35);
+        reservations.insert(1, 3);
+        expect(reservations.getRoot()->max_hi to_be 40);
+
+        std::vector<Interval<int>> found;
+        reservations.find_overlapping(7, 16, std::back_inserter(found));
+        expect(found to_be (std::vector<Interval<int>>{{5, 8}, {10, 20}, {15, 40}}));
+
+        // half open: [1, 3) does not contain 3 and [5, 8) does not overlap [3, 5)
+        found.clear();
+        reservations.find_overlapping(3, 5, std::back_inserter(found));
+        expect(found.empty() to_be true);
+        expect(reservations.stabbing(3).empty() to_be true);
+        expect(reservations.stabbing(32) to_be (std::vector<Interval<int>>{{15, 40}, {30, 35}}));
+
+        reservations.remove(15, 40);
+        expect(reservations.getRoot()->max_hi to_be 35);
+        expect(reservations.stabbing(36).empty() to_be true);
+
+        // compare against a brute force scan while rotations and removals reshape the tree
+        IntervalTree<int> tree;
+        std::vector<Interval<int>> all;
+        std::mt19937 gen(7);
+        std::uniform_int_distribution<int> start(0, 1000);
+        std::uniform_int_distribution<int> length(1, 50);
+        for (int i = 0; i < 2000; i++) {
+            int lo = start(gen);
+            Interval<int> interval{lo, lo + length(gen)};
+            if (tree.contains(interval)) continue;
+            tree.insert(interval);
+            all.push_back(interval);
+        }
+        for (int i = 0; i < 500; i++) {
+            tree.remove(all.back());
+            all.pop_back();
+        }
+        std::sort(all.begin(), all.end());
+
+        int mismatches = 0;
+        for (int i = 0; i < 200; i++) {
+            int lo = start(gen);
+            int hi = lo + length(gen);
+            std::vector<Interval<int>> expected;
+            for (const Interval<int>& interval : all) {
+                if (interval.lo < hi && lo < interval.hi) expected.push_back(interval);
+            }
+            found.clear();
+            tree.find_overlapping(lo, hi, std::back_inserter(found));
+            if (found != expected) mismatches++;
+
+            expected.clear();
+            for (const Interval<int>& interval : all) {
+                if (interval.lo <= lo && lo < interval.hi) expected.push_back(interval);
+            }
+            if (tree.stabbing(lo) != expected) mismatches++;
+        }
+        expect(mismatches to_be 0);
+    }
+
+    // sharded set
+    {
+        ShardedAVLSet<int> hashed(8);
+        for (int i = 0; i < 1000; i++) hashed.insert(i);
+        hashed.insert(5);
+        hashed.remove(10);
+        hashed.remove(-1);
+        expect(hashed.size() to_be 999u);
+        expect(hashed.contains(5) to_be true);
+        expect(hashed.contains(10) to_be false);
+
+        std::vector<int> ordered;
+        hashed.for_each([&](int n) { ordered.push_back(n); });
+        expect(ordered.size() to_be 999u);
+        expect(std::is_sorted(ordered.begin(), ordered.end()) to_be true);
+
+        hashed.clear();
+        expect(hashed.is_empty() to_be true);
+        expect(hashed.contains(5) to_be false);
+
+        // a range set starts with everything in one shard and reshards as it grows
+        ShardedAVLSet<int> ranged(4, ShardedAVLSet<int>::partition::range);
+        for (int i = 0; i < 4000; i++) ranged.insert(i);
+        size_t largest = 0;
+        for (size_t n : ranged.shard_sizes()) largest = std::max(largest, n);
+        expect(largest < 2500u);
+        expect(ranged.size() to_be 4000u);
+        for (int i = 0; i < 4000; i += 97) expect(ranged.contains(i) to_be true);
+
+        ordered.clear();
+        ranged.for_each([&](int n) { ordered.push_back(n); });
+        std::vector<int> expected(4000);
+        for (int i = 0; i < 4000; i++) expected[i] = i;
+        expect(ordered to_be expected);
+
+        // removes elsewhere leave the top shard over its share, which reshards too
+        ShardedAVLSet<int> shrinking(4, ShardedAVLSet<int>::partition::range);
+        for (int i = 0; i < 4000; i++) shrinking.insert(i);
+        for (int i = 0; i < 3000; i++) shrinking.remove(i);
+        largest = 0;
+        for (size_t n : shrinking.shard_sizes()) largest = std::max(largest, n);
+        expect(largest < 600u);
+        expect(shrinking.size() to_be 1000u);
+        for (int i = 3000; i < 4000; i += 7) expect(shrinking.contains(i) to_be true);
+
+        // concurrent writers on disjoint keys
+        ShardedAVLSet<int> shared(4, ShardedAVLSet<int>::partition::range);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; t++) {
+            writers.emplace_back([&shared, t] {
+                for (int i = 0; i < 2000; i++) shared.insert(i * 4 + t);
+                for (int i = 0; i < 2000; i += 2) shared.remove(i * 4 + t);
+            });
+        }
+        for (std::thread& writer : writers) writer.join();
+        expect(shared.size() to_be 4000u);
+        ordered.clear();
+        shared.for_each([&](int n) { ordered.push_back(n); });
+        expect(ordered.size() to_be 4000u);
+        expect(std::is_sorted(ordered.begin(), ordered.end()) to_be true);
+
+        // bulk load picks range bounds from the data
+        ShardedAVLSet<int> loaded(4, ShardedAVLSet<int>::partition::range);
+        std::vector<int> values(expected.rbegin(), expected.rend());
+        loaded.bulk_load(values.begin(), values.end());
+        expect(loaded.size() to_be 4000u);
+        expect(loaded.shard_sizes() to_be (std::vector<size_t>{1000, 1000, 1000, 1000}));
+        ordered.clear();
+        loaded.for_each([&](int n) { ordered.push_back(n); });
+        expect(ordered to_be expected);
+
+        // given split points stay put through uneven inserts, removes and bulk loads
+        ShardedAVLSet<int> split(std::vector<int>{300, 100, 200});
+        for (int i = 0; i < 1000; i++) split.insert(i);
+        expect(split.shard_sizes() to_be (std::vector<size_t>{100, 100, 100, 700}));
+        for (int i = 0; i < 300; i++) split.remove(i);
+        expect(split.shard_sizes() to_be (std::vector<size_t>{0, 0, 0, 700}));
+        ShardedAVLSet<int> split_loaded(std::vector<int>{100, 200, 300});
+        std::vector<int> evens(400);
+        for (int i = 0; i < 400; i++) evens[i] = 2 * i;
+        split_loaded.bulk_load(evens.begin(), evens.end());
+        expect(split_loaded.shard_sizes() to_be (std::vector<size_t>{50, 50, 50, 250}));
+        expect(split_loaded.contains(798) to_be true);
     }
 
+    // deferred reclamation
+    {
+        AVLTree<int> intTree;
+        for (int i = 0; i < 10; i++) intTree.insert(i);
+        expect_throw(intTree.pin(), std::invalid_argument);
+        intTree.enable_deferred_reclamation();
+
+        {
+            auto guard = intTree.pin();
+            auto it = intTree.begin() + 3;
+            intTree.remove(3);
+            intTree.remove(4);
+            // the removed node is retired, not freed, while the reader is pinned
+            expect(*it to_be 3);
+            // but it's unlinked, so a walk from it stops; is_retired tells the reader to re-seek
+            expect(it.is_retired() to_be true);
+            expect((intTree.begin() + 2).is_retired() to_be false);
+            expect(intTree.end().is_retired() to_be false);
+            auto walk = it;
+            expect((++walk == intTree.end()) to_be true);
+            walk = it;
+            expect((--walk == intTree.end()) to_be true);
+            expect(*intTree.upper_bound(*it) to_be 5);
+            expect(intTree.reclaim() to_be 0u);
+            auto stats = intTree.reclamation_status();
+            expect(stats.retired_nodes to_be 2u);
+            expect(stats.retired_bytes > 0u);
+            expect(stats.overhead_bytes > 0u);
+            expect(stats.lag to_be 1u);
+        }
 
+        // a reader pinned after the removal can't reach the retired nodes
+        auto later = intTree.pin();
+        expect(intTree.reclaim() to_be 2u);
+        auto stats = intTree.reclamation_status();
+        expect(stats.retired_nodes to_be 0u);
+        expect(stats.reclaimed_nodes to_be 2u);
+        expect(stats.lag to_be 0u);
+        expect(intTree.size() to_be 8u);
+        expect(intTree.contains(4) to_be false);
+    }
+
+    // deferred reclamation covers nodes handed out by extract and merge
+    {
+        AVLTree<std::string> tree, other;
+        for (int i = 0; i < 10; i++) tree.insert(std::string(20, char('a' + i)));
+        tree.enable_deferred_reclamation();
+        {
+            auto guard = tree.pin();
+            auto it = tree.begin() + 3;
+            auto next = tree.begin() + 4;
+            auto handle = tree.extract(*it);
+            expect(handle.value() to_be std::string(20, 'd'));
+            expect(*it to_be std::string(20, 'd')); // retired, still readable
+            other.insert(std::move(handle));
+            auto last = tree.begin() + 8;
+            tree.extract(last); // the handle frees its node right away
+            expect(*last to_be std::string(20, 'j'));
+
+            other.merge(tree);
+            expect(tree.is_empty() to_be true);
+            expect(tree.reclaim() to_be 0u);
+            expect(*it to_be std::string(20, 'd'));
+            expect(*next to_be std::string(20, 'e'));
+        }
+        expect(tree.reclaim() to_be 10u);
+        expect(other.size() to_be 9u);
+        expect(other.contains(std::string(20, 'd')) to_be true);
+        expect(other.validate() to_be true);
+    }
+
+    // deferred reclamation with readers holding iterators across lock releases
+    {
+        AVLTree<int> intTree;
+        for (int i = 0; i < 2000; i++) intTree.insert(i);
+        intTree.enable_deferred_reclamation();
+        std::shared_mutex lock;
+        std::atomic<bool> done{false};
+
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 3; t++) {
+            readers.emplace_back([&] {
+                while (!done) {
+                    auto guard = intTree.pin();
+                    std::shared_lock<std::shared_mutex> step(lock);
+                    auto it = intTree.begin();
+                    step.unlock();
+                    // the writer may remove the node under it between steps
+                    for (int i = 0; i < 50; i++) {
+                        step.lock();
+                        if (it == intTree.end()) break;
+                        volatile int value = *it;
+                        (void) value;
+                        if (it.is_retired()) it = intTree.upper_bound(*it);
+                        else ++it;
+                        step.unlock();
+                    }
+                }
+            });
+        }
+
+        for (int round = 0; round < 20; round++) {
+            for (int i = 0; i < 2000; i++) {
+                std::unique_lock<std::shared_mutex> writer(lock);
+                if (i % 2 == round % 2) intTree.remove(i);
+                else intTree.insert(i);
+            }
+        }
+        done = true;
+        for (std::thread& reader : readers) reader.join();
+        intTree.reclaim();
+        expect(intTree.reclamation_status().retired_nodes to_be 0u);
+    }
+
+    // lower_bound / upper_bound
+    {
+        AVLTree<int> intTree;
+        for (int i = 0; i < 20; i += 2) intTree.insert(i);
+        expect(*intTree.lower_bound(4) to_be 4);
+        expect(*intTree.lower_bound(5) to_be 6);
+        expect(*intTree.lower_bound(-3) to_be 0);
+        expect(intTree.lower_bound(19) to_be intTree.end());
+        expect(*intTree.upper_bound(4) to_be 6);
+        expect(*intTree.upper_bound(-1) to_be 0);
+        expect(intTree.upper_bound(18) to_be intTree.end());
+        expect(*(--intTree.upper_bound(5)) to_be 4);
+    }
+
+#ifdef AVL_HAS_COROUTINES
+    // interleaved coroutine lookups across trees
+    {
+        AVLTree<int> evens;
+        AVLTree<std::string> words;
+        for (int i = 0; i < 1000; i += 2) evens.insert(i);
+        words.insert("fig");
+        words.insert("kiwi");
+        words.insert("pear");
+
+        std::vector<AVLLookup<bool>> found;
+        for (int i = 0; i < 100; i++) found.push_back(evens.co_contains(i));
+        found.push_back(words.co_contains("kiwi"));
+        found.push_back(words.co_contains("plum"));
+        std::vector<AVLLookup<AVLTree<int>::iterator>> bounds;
+        for (int i = 0; i < 10; i++) bounds.push_back(evens.co_lower_bound(i * 101));
+
+        AVLScheduler scheduler(8);
+        for (auto& lookup : found) scheduler.add(lookup);
+        for (auto& lookup : bounds) scheduler.add(lookup);
+        scheduler.run();
+
+        int mismatches = 0;
+        for (int i = 0; i < 100; i++) {
+            if (!found[i].done() || found[i].result() != (i % 2 == 0)) mismatches++;
+        }
+        expect(mismatches to_be 0);
+        expect(found[100].result() to_be true);
+        expect(found[101].result() to_be false);
+        for (int i = 0; i < 10; i++) {
+            if (bounds[i].result() != evens.lower_bound(i * 101)) mismatches++;
+        }
+        expect(mismatches to_be 0);
+        expect(bounds[0].result() to_be evens.begin());
+        expect(bounds[9].result() to_be evens.lower_bound(909));
+
+        // a lookup can also run on its own
+        expect(evens.co_contains(998).get() to_be true);
+        AVLTree<int> empty;
+        expect(empty.co_contains(1).get() to_be false);
+        expect(empty.co_lower_bound(1).get() to_be empty.end());
+    }
+#endif
+
+    // streaming cursor
+    {
+        AVLTree<int> intTree;
+        for (int i = 0; i < 1000; i++) intTree.insert((i * 7919) % 1000);
+
+        std::vector<int> scanned;
+        int batch[7];
+        auto cursor = intTree.scan();
+        while (size_t n = cursor.next_batch(batch, 7)) scanned.insert(scanned.end(), batch, batch + n);
+        expect(cursor.done() to_be true);
+        std::vector<int> expected(intTree.begin(), intTree.end());
+        expect(scanned to_be expected);
+
+        // inserts and removes between batches
+        auto resumed = intTree.scan();
+        scanned.clear();
+        size_t n = resumed.next_batch(batch, 7);
+        scanned.insert(scanned.end(), batch, batch + n);
+        intTree.insert(-5);   // before the last value: not seen
+        intTree.insert(2000); // after: seen
+        intTree.remove(10);   // not yet returned: skipped
+        intTree.remove(3);    // already returned
+        while ((n = resumed.next_batch(batch, 7))) scanned.insert(scanned.end(), batch, batch + n);
+
+        expected.clear();
+        for (int i = 0; i < 1000; i++) {
+            if (i != 10) expected.push_back(i);
+        }
+        expected.push_back(2000);
+        expect(scanned to_be expected);
+
+        AVLTree<int> empty;
+        auto nothing = empty.scan();
+        expect(nothing.done() to_be true);
+        expect(nothing.next_batch(batch, 7) to_be 0u);
+        empty.insert(1);
+        expect(nothing.done() to_be false);
+
+#if __cplusplus >= 202002L
+        std::vector<int> buffer(4);
+        expect(nothing.next_batch(std::span<int>(buffer)) to_be 1u);
+        expect(buffer[0] to_be 1);
+#endif
+    }
+
+    // compile time tree
+    {
+        constexpr auto opcodes = [] {
+            StaticAVLTree<int, 16> tree;
+            for (int op : {0x31, 0x10, 0x02, 0x7f, 0x20, 0x11, 0x05, 0x40, 0x10}) tree.insert(op);
+            return tree;
+        }();
+
+        static_assert(opcodes.size() == 8);
+        static_assert(opcodes.contains(0x20));
+        static_assert(!opcodes.contains(0x21));
+        static_assert(opcodes.find_min() == 0x02);
+        static_assert(opcodes.find_max() == 0x7f);
+        static_assert(*(++opcodes.begin()) == 0x05);
+        static_assert(*(--opcodes.end()) == 0x7f);
+
+        constexpr bool sorted = [&] {
+            int previous = -1;
+            for (int op : opcodes) {
+                if (op <= previous) return false;
+                previous = op;
+            }
+            return true;
+        }();
+        static_assert(sorted);
+
+        // the same tree also works at run time and stays balanced through every rotation
+        StaticAVLTree<int, 1000> tree;
+        for (int i = 0; i < 1000; i++) tree.insert((i * 7919) % 1000);
+        expect(tree.size() to_be 1000u);
+        std::vector<int> values(tree.begin(), tree.end());
+        std::vector<int> expected(1000);
+        for (int i = 0; i < 1000; i++) expected[i] = i;
+        expect(values to_be expected);
+        expect(tree.contains(999) to_be true);
+        expect_throw(tree.insert(1000), std::length_error);
+
+        StaticAVLTree<char, 1> empty;
+        expect_throw(empty.find_min(), std::invalid_argument);
+        expect(empty.begin() to_be empty.end());
+    }
+
+    // reserved node storage
+    {
+        AVLTree<int> tree;
+        expect(tree.bytes_reserved() to_be 0u);
+        tree.reserve(100);
+        expect(tree.capacity() to_be 100u);
+        const size_t reserved = tree.bytes_reserved();
+        expect((reserved > 0) to_be true);
+
+        // nodes come out of the reserved block until it runs out
+        for (int i = 0; i < 100; i++) tree.insert((i * 37) % 100);
+        expect(tree.bytes_reserved() to_be reserved);
+        expect(tree.bytes_used() to_be reserved);
+        tree.insert(100);
+        expect((tree.bytes_reserved() > reserved) to_be true);
+
+        // removed nodes give their slot back
+        tree.remove(100);
+        tree.remove(50);
+        expect(tree.capacity() to_be 100u);
+        tree.insert(50);
+        expect(tree.bytes_reserved() to_be reserved);
+
+        // compact lays the nodes out in sorted order
+        for (int i = 100; i < 150; i++) tree.insert(i);
+        tree.compact();
+        expect(tree.size() to_be 150u);
+        expect(tree.bytes_reserved() to_be tree.bytes_used());
+        const std::ptrdiff_t node_size = tree.bytes_used() / tree.size();
+        int i = 0;
+        for (auto it = tree.begin(); it != tree.end(); ++it, ++i) {
+            expect(*it to_be i);
+            if (i > 0) expect(reinterpret_cast<const char*>(&*it) - reinterpret_cast<const char*>(&*std::prev(it)) to_be node_size);
+        }
+        expect(tree.find_min() to_be 0);
+        expect(tree.find_max() to_be 149);
+        expect(*(--tree.end()) to_be 149);
+
+        // node handles leave the reserved storage with the tree
+        auto handle = tree.extract(75);
+        AVLTree<int> other;
+        other.insert(std::move(handle));
+        other.merge(tree);
+        expect(tree.is_empty() to_be true);
+        expect(other.size() to_be 150u);
+        expect(tree.capacity() to_be 150u);
+
+        tree.shrink_to_fit();
+        expect(tree.capacity() to_be 0u);
+        expect(tree.bytes_reserved() to_be 0u);
+
+        // storage reserved a little at a time takes every node back too
+        AVLTree<int> grown;
+        for (int i = 0; i < 500; i++) {
+            grown.reserve(grown.size() + 2);
+            grown.insert(i);
+        }
+        const size_t grown_capacity = grown.capacity();
+        for (int i = 0; i < 500; i += 2) grown.remove(i);
+        expect(grown.capacity() to_be grown_capacity);
+        expect(grown.bytes_reserved() to_be grown_capacity * (grown.bytes_used() / grown.size()));
+
+        // copies keep their nodes in the copied-to tree's storage
+        AVLTree<std::string> words;
+        words.reserve(3);
+        for (const char* word : {"pear", "fig", "apple", "kiwi"}) words.insert(word);
+        words.shrink_to_fit();
+        AVLTree<std::string> copy = words;
+        copy.remove("fig");
+        words = copy;
+        expect(words.size() to_be 3u);
+        expect(*words.begin() to_be std::string("apple"));
+
+        // nodes don't move under a pinned reader, retired or not
+        words.enable_deferred_reclamation();
+        words.remove("kiwi");
+        {
+            auto guard = words.pin();
+            auto it = words.begin();
+            expect_throw(words.compact(), std::logic_error);
+            expect_throw(words.shrink_to_fit(), std::logic_error);
+            expect(*it to_be std::string("apple"));
+        }
+        words.compact();
+        expect(words.reclamation_status().retired_nodes to_be 0u);
+        expect(words.validate() to_be true);
+
+        // a value whose copy throws leaves the tree as it was
+        struct Fragile {
+            int key;
+            int* copies_left;
+            Fragile(int k, int* left) : key{k}, copies_left{left} {}
+            Fragile(const Fragile& other) : key{other.key}, copies_left{other.copies_left} {
+                if (*copies_left == 0) throw std::runtime_error("copy failed");
+                --*copies_left;
+            }
+            Fragile& operator=(const Fragile&) = default;
+            bool operator<(const Fragile& other) const { return key < other.key; }
+            bool operator>(const Fragile& other) const { return key > other.key; }
+            bool operator==(const Fragile& other) const { return key == other.key; }
+        };
+        int copies_left = -1;
+        AVLTree<Fragile> fragile;
+        fragile.reserve(20);
+        for (int i = 0; i < 20; i++) fragile.insert(Fragile(i, &copies_left));
+        copies_left = 5;
+        expect_throw(fragile.compact(), std::runtime_error);
+        expect(fragile.size() to_be 20u);
+        expect(fragile.validate() to_be true);
+        copies_left = 0;
+        expect_throw(fragile.extract(Fragile(7, &copies_left)), std::runtime_error);
+        expect(fragile.size() to_be 20u);
+        expect(fragile.contains(Fragile(7, &copies_left)) to_be true);
+        expect(fragile.validate() to_be true);
+        copies_left = -1;
+        fragile.compact();
+        int key = 0;
+        for (const Fragile& value : fragile) expect(value.key to_be key++);
+    }
+
+    // balance policies
+    {
+        // walks the tree checking order, parents and the policy's balance rule, returns the height
+        bool balanced = true;
+        auto check = [&](auto& self, const auto* node, const void* parent, int slack, bool ranked) -> int {
+            if (!node) return 0;
+            if (node->parent != parent) balanced = false;
+            if (node->left && !(node->left->value < node->value)) balanced = false;
+            if (node->right && !(node->value < node->right->value)) balanced = false;
+
+            const int left = self(self, node->left, node, slack, ranked);
+            const int right = self(self, node->right, node, slack, ranked);
+            if (ranked) {
+                const int left_rank = node->left ? node->left->height : 0;
+                const int right_rank = node->right ? node->right->height : 0;
+                if (node->height - left_rank < 1 || node->height - left_rank > 2) balanced = false;
+                if (node->height - right_rank < 1 || node->height - right_rank > 2) balanced = false;
+                if (!node->left && !node->right && node->height != 1) balanced = false;
+            }
+            else {
+                if (node->height != std::max(left, right) + 1) balanced = false;
+                if (std::abs(left - right) > slack) balanced = false;
+            }
+            return std::max(left, right) + 1;
+        };
+
+        AVLTree<int> strict;
+        AVLTree<int, AVLRelaxed<3>> relaxed;
+        AVLTree<int, AVLRankBalanced> ranked;
+        std::set<int> expected;
+        std::mt19937 gen(7);
+        std::uniform_int_distribution<int> key(0, 2000);
+        for (int i = 0; i < 20000; i++) {
+            const int value = key(gen);
+            if (i % 3 == 2) {
+                strict.remove(value);
+                relaxed.remove(value);
+                ranked.remove(value);
+                expected.erase(value);
+            }
+            else {
+                strict.insert(value);
+                relaxed.insert(value);
+                ranked.insert(value);
+                expected.insert(value);
+            }
+            check(check, strict.getRoot(), nullptr, 1, false);
+            check(check, relaxed.getRoot(), nullptr, 3, false);
+            check(check, ranked.getRoot(), nullptr, 0, true);
+        }
+        expect(balanced to_be true);
+
+        std::vector<int> values(expected.begin(), expected.end());
+        expect(std::vector<int>(strict.begin(), strict.end()) to_be values);
+        expect(std::vector<int>(relaxed.begin(), relaxed.end()) to_be values);
+        expect(std::vector<int>(ranked.begin(), ranked.end()) to_be values);
+        expect((relaxed.rotation_count() < strict.rotation_count()) to_be true);
+        expect((ranked.rotation_count() < strict.rotation_count()) to_be true);
+
+        // rebalancing in one batch keeps every node and iterator
+        auto it = relaxed.begin();
+        relaxed.rebalance_all();
+        check(check, relaxed.getRoot(), nullptr, 1, false);
+        expect(balanced to_be true);
+        expect(*it to_be values.front());
+        expect(std::vector<int>(relaxed.begin(), relaxed.end()) to_be values);
+        int levels = 0;
+        while ((size_t(1) << levels) <= values.size()) levels++;
+        expect(relaxed.getRoot()->height to_be levels);
+
+        // without removes a rank balanced tree is an AVL tree
+        AVLTree<int> strict_inserts;
+        AVLTree<int, AVLRankBalanced> ranked_inserts;
+        for (int i = 0; i < 5000; i++) {
+            strict_inserts.insert((i * 7919) % 5000);
+            ranked_inserts.insert((i * 7919) % 5000);
+        }
+        expect(ranked_inserts.rotation_count() to_be strict_inserts.rotation_count());
+        expect(ranked_inserts.getRoot()->value to_be strict_inserts.getRoot()->value);
+        expect(ranked_inserts.getRoot()->height to_be strict_inserts.getRoot()->height);
+
+        // removing the minimum over and over goes through every demotion and rotation case
+        while (!ranked.is_empty()) {
+            ranked.remove(*ranked.begin());
+            check(check, ranked.getRoot(), nullptr, 0, true);
+        }
+        expect(balanced to_be true);
+        expect(ranked.size() to_be 0u);
+        expect(ranked.begin() to_be ranked.end());
+    }
+
+    // dense integer set
+    {
+        DenseAVLSet<uint64_t> ids;
+        std::set<uint64_t> expected;
+        std::mt19937_64 gen(11);
+        // clustered ids, with a few far away ones and some below the first block
+        for (int i = 0; i < 20000; i++) {
+            uint64_t id;
+            if (i % 50 == 0) id = gen();
+            else id = 1000000 + (gen() % 40) * 100000 + gen() % 3000;
+            if (i % 4 == 3) {
+                ids.remove(id);
+                expected.erase(id);
+            }
+            else {
+                ids.insert(id);
+                expected.insert(id);
+            }
+        }
+        for (uint64_t id = 999990; id > 999000; id -= 10) {
+            ids.insert(id);
+            expected.insert(id);
+        }
+
+        expect(ids.size() to_be expected.size());
+        expect(std::vector<uint64_t>(ids.begin(), ids.end()) to_be std::vector<uint64_t>(expected.begin(), expected.end()));
+        expect(ids.find_min() to_be *expected.begin());
+        expect(ids.find_max() to_be *expected.rbegin());
+        for (uint64_t id = 999000; id < 1010000; id++) {
+            if (ids.contains(id) != (expected.count(id) == 1)) {
+                expect(ids.contains(id) to_be (expected.count(id) == 1));
+                break;
+            }
+        }
+        expect(ids.contains(0) to_be false);
+        // clustered keys take a fraction of a tree node each
+        expect((ids.bytes_used() < ids.size() * 8) to_be true);
+
+        // iterating backwards decodes the same keys
+        std::vector<uint64_t> backwards;
+        for (auto it = ids.end(); it != ids.begin();) backwards.push_back(*--it);
+        expect(std::vector<uint64_t>(backwards.rbegin(), backwards.rend()) to_be std::vector<uint64_t>(expected.begin(), expected.end()));
+
+        // signed keys order across zero, blocks split and empty out
+        DenseAVLSet<int> numbers;
+        for (int i = -5000; i < 5000; i += 3) numbers.insert(i);
+        expect(numbers.size() to_be 3334u);
+        expect((numbers.block_count() > 10) to_be true);
+        expect(numbers.find_min() to_be -5000);
+        expect(*numbers.begin() to_be -5000);
+        expect(numbers.contains(-2) to_be true);
+        expect(numbers.contains(-1) to_be false);
+        for (int i = -5000; i < 5000; i += 3) numbers.remove(i);
+        expect(numbers.is_empty() to_be true);
+        expect(numbers.block_count() to_be 0u);
+        expect(numbers.begin() to_be numbers.end());
+        expect_throw(numbers.find_max(), std::invalid_argument);
+
+        // 8 bit keys, every value in descending order so each one rebases the first block
+        DenseAVLSet<int8_t> tiny;
+        DenseAVLSet<uint8_t> small;
+        for (int i = 255; i >= 0; i--) {
+            tiny.insert(static_cast<int8_t>(i - 128));
+            small.insert(static_cast<uint8_t>(i));
+        }
+        expect(tiny.size() to_be 256u);
+        expect(small.size() to_be 256u);
+        expect(tiny.find_min() to_be -128);
+        expect(tiny.find_max() to_be 127);
+        expect(small.find_max() to_be 255);
+        int next = -128;
+        for (int8_t key : tiny) expect(key to_be next++);
+        expect(next to_be 128);
+    }
+
+    // write-ahead log and snapshots
+    {
+        const std::string path = "/tmp/avl_tests_" + std::to_string(::getpid());
+        auto erase_files = [&] {
+            for (const char* suffix : {".log", ".snapshot", ".snapshot.tmp"}) std::remove((path + suffix).c_str());
+        };
+        auto file_size = [](const std::string& name) {
+            std::ifstream file(name, std::ios::binary | std::ios::ate);
+            return static_cast<size_t>(file.tellg());
+        };
+        erase_files();
+
+        std::set<int> expected;
+        {
+            DurableAVLTree<int> tree(path, AVLDurability{8, 0});
+            expect(tree.is_empty() to_be true);
+            for (int i = 0; i < 100; i++) tree.insert((i * 37) % 100);
+            for (int i = 0; i < 100; i += 3) tree.remove(i);
+            for (int i = 0; i < 100; i++) if (i % 3) expected.insert(i);
+        }
+        {
+            // the log alone rebuilds the tree
+            DurableAVLTree<int> tree(path);
+            expect(std::vector<int>(tree.begin(), tree.end()) to_be std::vector<int>(expected.begin(), expected.end()));
+
+            tree.snapshot();
+            expect(tree.log_size() to_be file_size(path + ".log"));
+            for (int i = 100; i < 120; i++) tree.insert(i);
+            tree.remove(1);
+            tree.commit();
+            for (int i = 100; i < 120; i++) expected.insert(i);
+            expected.erase(1);
+        }
+        {
+            // snapshot plus log tail
+            DurableAVLTree<int> tree(path);
+            expect(tree.size() to_be expected.size());
+            expect(std::vector<int>(tree.begin(), tree.end()) to_be std::vector<int>(expected.begin(), expected.end()));
+        }
+
+        // a torn last record is dropped and later records follow the good ones
+        const size_t good = file_size(path + ".log");
+        {
+            std::ofstream log(path + ".log", std::ios::binary | std::ios::app);
+            const char torn[] = {9, 0, 0, 0, 1, 2, 3};
+            log.write(torn, sizeof(torn));
+        }
+        {
+            DurableAVLTree<int> tree(path);
+            expect(tree.size() to_be expected.size());
+            expect(file_size(path + ".log") to_be good);
+            tree.insert(500);
+            expected.insert(500);
+        }
+        {
+            // a flipped byte fails the checksum, so replay stops before that record
+            std::fstream log(path + ".log", std::ios::binary | std::ios::in | std::ios::out);
+            log.seekp(-1, std::ios::end);
+            log.put('\x7f');
+        }
+        {
+            DurableAVLTree<int> tree(path);
+            expect(tree.contains(500) to_be false);
+            expect(tree.size() to_be expected.size() - 1);
+        }
+
+        // automatic snapshots once the log grows, with string values
+        erase_files();
+        {
+            DurableAVLTree<std::string> words(path, AVLDurability{4, 256});
+            for (int i = 0; i < 200; i++) words.insert("word" + std::to_string(i));
+            words.remove("word7");
+            expect((words.log_size() < 512) to_be true);
+        }
+        {
+            DurableAVLTree<std::string> words(path);
+            expect(words.size() to_be 199u);
+            expect(words.contains("word199") to_be true);
+            expect(words.contains("word7") to_be false);
+        }
+
+        // a damaged snapshot or another format version is an error rather than silently lost data
+        {
+            std::fstream snapshot(path + ".snapshot", std::ios::binary | std::ios::in | std::ios::out);
+            snapshot.seekp(20);
+            snapshot.put('?');
+        }
+        expect_throw(DurableAVLTree<std::string> words(path), std::runtime_error);
+        erase_files();
+        {
+            std::ofstream log(path + ".log", std::ios::binary);
+            log.write("AVLWAL\x09\x00", 8);
+        }
+        expect_throw(DurableAVLTree<int> tree(path), std::runtime_error);
+        // and the failed constructor doesn't leave the log open: the lowest free descriptor stays the same
+        auto lowest_free = [] {
+            const int fd = ::dup(0);
+            ::close(fd);
+            return fd;
+        };
+        const int free_before = lowest_free();
+        for (int i = 0; i < 20; i++) expect_throw(DurableAVLTree<int> tree(path), std::runtime_error);
+        expect(lowest_free() to_be free_before);
+
+        // a commit that fails partway (here the file size limit) leaves the log as it was,
+        // so the retry and the reopen keep every committed record
+        erase_files();
+        {
+            DurableAVLTree<int> tree(path, AVLDurability{1000, 0});
+            for (int i = 0; i < 10; i++) tree.insert(i);
+            tree.commit();
+            const size_t committed = file_size(path + ".log");
+            for (int i = 10; i < 200; i++) tree.insert(i);
+
+            rlimit limit;
+            ::getrlimit(RLIMIT_FSIZE, &limit);
+            const rlimit tight{static_cast<rlim_t>(committed + 100), limit.rlim_max};
+            auto handler = std::signal(SIGXFSZ, SIG_IGN);
+            ::setrlimit(RLIMIT_FSIZE, &tight);
+            expect_throw(tree.commit(), std::system_error);
+            ::setrlimit(RLIMIT_FSIZE, &limit);
+            std::signal(SIGXFSZ, handler);
+
+            expect(file_size(path + ".log") to_be committed);
+            tree.commit();
+            expect(tree.log_size() to_be file_size(path + ".log"));
+        }
+        {
+            DurableAVLTree<int> tree(path);
+            expect(tree.size() to_be 200u);
+            expect(tree.contains(199) to_be true);
+        }
+        erase_files();
+    }
+
+    // invariant checker
+    {
+        AVLTree<int> tree;
+        expect(tree.validate() to_be true);
+        for (int i = 0; i < 1000; i++) tree.insert((i * 7919) % 1000);
+        for (int i = 0; i < 1000; i += 7) tree.remove(i);
+        expect(tree.validate() to_be true);
+
+        AVLTree<int, AVLRankBalanced> ranked;
+        for (int i = 0; i < 1000; i++) ranked.insert(i);
+        for (int i = 0; i < 1000; i += 2) ranked.remove(i);
+        expect(ranked.validate() to_be true);
+
+        IntervalTree<int> intervals;
+        for (int i = 0; i < 100; i++) intervals.insert(i, i + 10);
+        expect(intervals.validate() to_be true);
+
+        // breaking any link, height or order is caught
+        using Node = std::remove_const_t<std::remove_pointer_t<decltype(tree.getRoot())>>;
+        Node* root = const_cast<Node*>(tree.getRoot());
+        root->height++;
+        expect(tree.validate() to_be false);
+        root->height--;
+        std::swap(root->left->value, root->right->value);
+        expect(tree.validate() to_be false);
+        std::swap(root->left->value, root->right->value);
+        Node* child = root->left;
+        child->parent = child;
+        expect(tree.validate() to_be false);
+        child->parent = root;
+        expect(tree.validate() to_be true);
+    }
+
+    // range counts, quantiles and sampling
+    {
+        AVLTree<int> tree;
+        std::set<int> expected;
+        std::mt19937 gen(7);
+        std::uniform_int_distribution<int> dist(0, 4999);
+        for (int i = 0; i < 3000; i++) {
+            const int value = dist(gen);
+            if (i % 3 == 2) { tree.remove(value); expected.erase(value); }
+            else { tree.insert(value); expected.insert(value); }
+        }
+        expect(tree.validate() to_be true);
+
+        for (int lo = -10; lo < 5100; lo += 97) {
+            for (int hi : {lo - 1, lo, lo + 1, lo + 250, lo + 4000}) {
+                const size_t reference = lo < hi ? std::distance(expected.lower_bound(lo), expected.lower_bound(hi)) : 0;
+                expect(tree.count_between(lo, hi) to_be reference);
+            }
+        }
+
+        const std::vector<int> sorted(expected.begin(), expected.end());
+        const size_t n = sorted.size();
+        expect(tree.quantile(0) to_be sorted.front());
+        expect(tree.quantile(1) to_be sorted.back());
+        expect(tree.quantile(0.5) to_be sorted[(n + 1) / 2 - 1]);
+        expect(tree.quantile(0.99) to_be sorted[size_t(std::ceil(0.99 * n)) - 1]);
+        expect_throw(tree.quantile(-0.1), std::invalid_argument);
+        expect_throw(tree.quantile(1.5), std::invalid_argument);
+        expect_throw(AVLTree<int>().quantile(0.5), std::invalid_argument);
+
+        std::mt19937_64 rng(11);
+        std::vector<int> sample = tree.sample(100, rng);
+        expect(sample.size() to_be 100);
+        expect((std::adjacent_find(sample.begin(), sample.end(), std::greater_equal<int>()) == sample.end()) to_be true);
+        for (int value : sample) expect(expected.count(value) to_be 1);
+        expect((tree.sample(n + 5, rng) == sorted) to_be true);
+        expect(tree.sample(0, rng).empty() to_be true);
+
+        // iterator arithmetic goes through the subtree sizes
+        expect(size_t(tree.end() - tree.begin()) to_be n);
+        expect(*(tree.begin() + 1234) to_be sorted[1234]);
+        expect(((tree.begin() + (n + 10)) == tree.end()) to_be true);
+        expect(*(tree.end() - 1) to_be sorted.back());
+        expect((tree.lower_bound(sorted[900]) - tree.lower_bound(sorted[100])) to_be 800);
+        expect((tree.lower_bound(sorted[100]) - tree.lower_bound(sorted[900])) to_be -800);
+
+        // sizes stay right through rotations of every policy and through rebuilds
+        AVLTree<int, AVLRelaxed<2>> relaxed;
+        AVLTree<int, AVLRankBalanced> ranked;
+        for (int i = 0; i < 2000; i++) { relaxed.insert(i); ranked.insert(2000 - i); }
+        for (int i = 0; i < 2000; i += 3) { relaxed.remove(i); ranked.remove(i); }
+        expect(relaxed.validate() to_be true);
+        expect(ranked.validate() to_be true);
+        expect(relaxed.count_between(100, 200) to_be 67);
+        expect(ranked.quantile(0) to_be 1);
+        tree.rebalance_all();
+        tree.compact();
+        expect(tree.validate() to_be true);
+        expect(tree.count_between(0, 5000) to_be n);
+    }
+
+    // parallel traversal
+    {
+        AVLTree<int> tree;
+        expect(tree.parallel_reduce(7LL, std::plus<long long>()) to_be 7);
+        tree.parallel_for_each([](int) { throw std::logic_error("no values to visit"); });
+
+        const int N = 50000;
+        for (int i = 0; i < N; i++) tree.insert((i * 7919) % N);
+        const long long total = (long long)N * (N - 1) / 2;
+
+        for (unsigned threads : {1u, 3u, 8u, 0u}) {
+            std::atomic<long long> sum{0};
+            std::atomic<int> visited{0};
+            tree.parallel_for_each([&](int value) { sum += value; visited++; }, threads);
+            expect(sum.load() to_be total);
+            expect(visited.load() to_be N);
+            expect(tree.parallel_reduce(0LL, std::plus<long long>(), threads) to_be total);
+        }
+
+        // not commutative: the pieces are combined in order
+        AVLTree<std::string> words;
+        std::string joined;
+        for (int i = 0; i < 10000; i++) words.insert(std::to_string(i));
+        for (const std::string& word : words) joined += word;
+        for (unsigned threads : {1u, 4u, 16u}) {
+            expect((words.parallel_reduce(std::string("<"), std::plus<std::string>(), threads) == "<" + joined) to_be true);
+        }
+        auto first = [](int a, int b) { return a < b ? a : b; };
+        expect(tree.parallel_reduce(N, first, 4) to_be 0);
+
+        expect_throw(tree.parallel_for_each([](int value) { if (value == 12345) throw std::logic_error("stop"); }, 4), std::logic_error);
+    }
+
+    // finger search
+    {
+        AVLTree<int> tree;
+        expect((tree.find_near(tree.end(), 3) == tree.end()) to_be true);
+        expect((tree.find_near(3) == tree.end()) to_be true);
+        tree.remove_near(3);
+
+        for (int i = 0; i < 2000; i += 2) tree.insert(i);
+        // from every fourth value, every value and every gap, and from end()
+        for (int from = 0; from < 2000; from += 8) {
+            auto finger = tree.lower_bound(from);
+            for (int value = -3; value < 2003; value++) {
+                auto it = tree.find_near(finger, value);
+                const bool present = value >= 0 && value < 2000 && value % 2 == 0;
+                expect((it == tree.end()) to_be !present);
+                if (present) expect(*it to_be value);
+            }
+        }
+        expect(*tree.find_near(tree.end(), 1000) to_be 1000);
+        expect(*tree.find_near(tree.end(), 1998) to_be 1998);
+
+        // the cached finger follows the calls, hits and misses alike
+        for (int value = 1999; value >= -1; value--) {
+            expect((tree.find_near(value) != tree.end()) to_be (value >= 0 && value % 2 == 0));
+        }
+
+        // sequential inserts and removes through the finger, under every policy
+        AVLTree<int, AVLRankBalanced> ranked;
+        AVLTree<int, AVLRelaxed<2>> relaxed;
+        std::set<int> expected;
+        std::mt19937 gen(3);
+        std::uniform_int_distribution<int> step(-5, 5);
+        int value = 5000;
+        for (int i = 0; i < 20000; i++) {
+            value += step(gen);
+            if (i % 3 == 2) {
+                tree.remove_near(value);
+                ranked.remove_near(value);
+                relaxed.remove_near(value);
+                expected.erase(value);
+            }
+            else {
+                expect(*tree.insert_near(value) to_be value);
+                expect(*ranked.insert_near(value) to_be value);
+                expect(*relaxed.insert_near(value) to_be value);
+                expected.insert(value);
+            }
+        }
+        expect(ranked.validate() to_be true);
+        expect(relaxed.validate() to_be true);
+        expect(tree.validate() to_be true);
+        expect((std::vector<int>(ranked.begin(), ranked.end()) == std::vector<int>(expected.begin(), expected.end())) to_be true);
+        expect((std::vector<int>(relaxed.begin(), relaxed.end()) == std::vector<int>(expected.begin(), expected.end())) to_be true);
+
+        // removing or moving the cached node forgets it
+        ranked.find_near(*ranked.begin());
+        ranked.remove(*ranked.begin());
+        const int smallest = *ranked.begin();
+        expect(*ranked.find_near(smallest) to_be smallest);
+        ranked.compact();
+        expect(*ranked.find_near(*ranked.rbegin()) to_be *ranked.rbegin());
+        ranked.clear();
+        auto inserted = ranked.insert_near(1);
+        expect((inserted == ranked.begin()) to_be true);
+        ranked.remove_near(1);
+        expect(ranked.is_empty() to_be true);
+    }
 
     /*
     // commented out as .min and .max are meant to be private.
@@ -0,0 +1,349 @@
+/*
+ *  Durable AVL tree: a write-ahead log and snapshots on top of AVLTree (POSIX)
+ *  Every insert and remove is appended to <path>.log and the log is fsynced once per
+ *  group of records (or on commit). snapshot() writes the whole tree to <path>.snapshot
+ *  through a temporary file and a rename, then empties the log. Opening the tree loads
+ *  the snapshot in bulk and replays the log up to its first torn or corrupt record.
+ *
+ *  log:       "AVLWAL" version(u16) then records: length(u32) crc32(u32) op(u8) value
+ *  snapshot:  "AVLSNP" version(u16) count(u64) values... crc32(u32) of everything before
+ *  Integers are stored in host byte order, so files move only between like machines.
+*/
+
+#pragma once
+
+#include "avl.h"
+#include <string>
+#include <vector> // crc table
+#include <cstring> // std::memcpy
+#include <cstdint> // uint32_t, uint64_t
+#include <type_traits> // std::is_trivially_copyable
+#include <system_error> // std::system_error
+#include <stdexcept> // std::runtime_error
+#include <cerrno> // errno
+#include <cstdio> // rename
+#include <fcntl.h> // open
+#include <unistd.h> // write, fsync, ftruncate, close
+
+// Turns values into bytes for the log and snapshots. Specialize it for other value types.
+// decode reads one value from [data, end), advancing data, and returns false if it's cut short.
+template <typename T>
+struct AVLCodec {
+    static_assert(std::is_trivially_copyable_v<T>, "Specialize AVLCodec for this value type");
+
+    static void encode(const T& value, std::string& out) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static bool decode(const char*& data, const char* end, T& value) {
+        if (end - data < static_cast<std::ptrdiff_t>(sizeof(T))) return false;
+        std::memcpy(&value, data, sizeof(T));
+        data += sizeof(T);
+        return true;
+    }
+};
+
+template <>
+struct AVLCodec<std::string> {
+    static void encode(const std::string& value, std::string& out) {
+        const uint32_t length = static_cast<uint32_t>(value.size());
+        out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.append(value);
+    }
+
+    static bool decode(const char*& data, const char* end, std::string& value) {
+        uint32_t length;
+        if (!AVLCodec<uint32_t>::decode(data, end, length) || end - data < static_cast<std::ptrdiff_t>(length)) return false;
+        value.assign(data, length);
+        data += length;
+        return true;
+    }
+};
+
+// CRC-32 (IEEE, as used by zlib)
+inline uint32_t avl_crc32(const char* data, size_t length, uint32_t crc = 0) {
+    static const auto table = [] {
+        std::vector<uint32_t> entries(256);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t entry = i;
+            for (int bit = 0; bit < 8; bit++) entry = (entry & 1) ? (entry >> 1) ^ 0xedb88320u : entry >> 1;
+            entries[i] = entry;
+        }
+        return entries;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+struct AVLDurability {
+    size_t group_size = 64;              // records buffered per write and fsync of the log
+    size_t snapshot_log_bytes = 64 << 20; // log size that triggers a snapshot, 0 for explicit snapshots only
+};
+
+template <typename Comparable, typename Codec = AVLCodec<Comparable>>
+class DurableAVLTree {
+    private:
+        static constexpr uint16_t version = 1;
+        static constexpr char log_magic[6] = {'A', 'V', 'L', 'W', 'A', 'L'};
+        static constexpr char snapshot_magic[6] = {'A', 'V', 'L', 'S', 'N', 'P'};
+        static constexpr size_t header_size = sizeof(log_magic) + sizeof(version);
+        enum op : uint8_t { insert_op = 1, remove_op = 2 };
+
+        AVLTree<Comparable> _tree;
+        std::string path;
+        AVLDurability options;
+        int log;           // file descriptor of the log
+        size_t log_bytes;  // written to the log so far, including the header
+        std::string pending; // records not yet written
+        size_t pending_records;
+        bool failed; // a failed commit couldn't cut the log back, so nothing more can be appended safely
+
+        [[noreturn]] static void fail(const std::string& what) {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+        static void write_all(int fd, const char* data, size_t length, const std::string& name) {
+            while (length > 0) {
+                const ssize_t written = ::write(fd, data, length);
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    fail("Can't write " + name);
+                }
+                data += written;
+                length -= static_cast<size_t>(written);
+            }
+        }
+
+        static bool read_file(const std::string& name, std::string& contents) {
+            const int fd = ::open(name.c_str(), O_RDONLY);
+            if (fd < 0) {
+                if (errno == ENOENT) return false;
+                fail("Can't open " + name);
+            }
+            contents.clear();
+            char buffer[1 << 16];
+            ssize_t count;
+            while ((count = ::read(fd, buffer, sizeof(buffer))) != 0) {
+                if (count < 0) {
+                    if (errno == EINTR) continue;
+                    ::close(fd);
+                    fail("Can't read " + name);
+                }
+                contents.append(buffer, static_cast<size_t>(count));
+            }
+            ::close(fd);
+            return true;
+        }
+
+        static std::string header(const char (&magic)[6]) {
+            std::string bytes(magic, sizeof(magic));
+            bytes.append(reinterpret_cast<const char*>(&version), sizeof(version));
+            return bytes;
+        }
+
+        static void check_header(const std::string& contents, const char (&magic)[6], const std::string& name) {
+            if (contents.size() < header_size || contents.compare(0, sizeof(magic), magic, sizeof(magic)) != 0)
+                throw std::runtime_error(name + " is not an AVL tree file");
+            uint16_t found;
+            std::memcpy(&found, contents.data() + sizeof(magic), sizeof(found));
+            if (found != version) throw std::runtime_error(name + " has unsupported version " + std::to_string(found));
+        }
+
+        // directory entries (the renamed snapshot) only survive a crash once the directory is synced
+        void sync_directory() const {
+            const size_t slash = path.find_last_of('/');
+            const std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+            const int fd = ::open(directory.c_str(), O_RDONLY);
+            if (fd < 0) fail("Can't open " + directory);
+            const int synced = ::fsync(fd);
+            ::close(fd);
+            if (synced != 0) fail("Can't sync " + directory);
+        }
+
+        void load_snapshot() {
+            const std::string name = path + ".snapshot";
+            std::string contents;
+            if (!read_file(name, contents)) return;
+
+            check_header(contents, snapshot_magic, name);
+            // written through a rename, so a bad snapshot is damage rather than a torn write
+            uint32_t crc;
+            if (contents.size() < header_size + sizeof(uint64_t) + sizeof(crc)) throw std::runtime_error(name + " is truncated");
+            std::memcpy(&crc, contents.data() + contents.size() - sizeof(crc), sizeof(crc));
+            if (avl_crc32(contents.data(), contents.size() - sizeof(crc)) != crc) throw std::runtime_error(name + " is corrupt");
+
+            const char* data = contents.data() + header_size;
+            const char* end = contents.data() + contents.size() - sizeof(crc);
+            uint64_t count = 0;
+            AVLCodec<uint64_t>::decode(data, end, count);
+            Comparable value{};
+            for (uint64_t i = 0; i < count; i++) {
+                if (!Codec::decode(data, end, value)) throw std::runtime_error(name + " is corrupt");
+                _tree.append_max(value); // stored in order, so every value goes past the max
+            }
+        }
+
+        // replays records up to the first torn or corrupt one and returns the length of the good prefix
+        size_t replay_log(const std::string& contents) {
+            const char* good = contents.data() + header_size;
+            const char* end = contents.data() + contents.size();
+            uint32_t length, crc;
+            Comparable value{};
+
+            for (;;) {
+                const char* data = good;
+                if (!AVLCodec<uint32_t>::decode(data, end, length) || !AVLCodec<uint32_t>::decode(data, end, crc)) break;
+                if (length == 0 || end - data < static_cast<std::ptrdiff_t>(length) || avl_crc32(data, length) != crc) break;
+
+                const char* record = data + 1;
+                if (!Codec::decode(record, data + length, value) || record != data + length) break;
+                if (*data == insert_op) _tree.insert(value);
+                else if (*data == remove_op) _tree.remove(value);
+                else break;
+                good = data + length;
+            }
+            return static_cast<size_t>(good - contents.data());
+        }
+
+        void open_log() {
+            const std::string name = path + ".log";
+            std::string contents;
+            const bool exists = read_file(name, contents);
+
+            const bool fresh = !exists || contents.empty();
+            if (!fresh) check_header(contents, log_magic, name);
+
+            log = ::open(name.c_str(), O_WRONLY | O_CREAT, 0644);
+            if (log < 0) fail("Can't open " + name);
+            // called from the constructor, so the destructor won't close the log if this throws
+            try {
+                if (fresh) {
+                    const std::string bytes = header(log_magic);
+                    write_all(log, bytes.data(), bytes.size(), name);
+                    if (::fsync(log) != 0) fail("Can't sync " + name);
+                    log_bytes = bytes.size();
+                    return;
+                }
+
+                log_bytes = replay_log(contents);
+                // drop a torn tail so new records follow the last good one
+                if (log_bytes != contents.size() && ::ftruncate(log, static_cast<off_t>(log_bytes)) != 0) fail("Can't truncate " + name);
+                if (::lseek(log, static_cast<off_t>(log_bytes), SEEK_SET) < 0) fail("Can't seek " + name);
+            } catch (...) {
+                ::close(log);
+                log = -1;
+                throw;
+            }
+        }
+
+        void append(op operation, const Comparable& value) {
+            const size_t start = pending.size();
+            pending.append(2 * sizeof(uint32_t), '\0');
+            pending.push_back(static_cast<char>(operation));
+            Codec::encode(value, pending);
+
+            const uint32_t length = static_cast<uint32_t>(pending.size() - start - 2 * sizeof(uint32_t));
+            const uint32_t crc = avl_crc32(pending.data() + start + 2 * sizeof(uint32_t), length);
+            std::memcpy(&pending[start], &length, sizeof(length));
+            std::memcpy(&pending[start + sizeof(length)], &crc, sizeof(crc));
+
+            if (++pending_records >= options.group_size) commit();
+            if (options.snapshot_log_bytes && log_bytes >= options.snapshot_log_bytes) snapshot();
+        }
+
+    public:
+        // opens (or creates) the tree stored at path.snapshot and path.log
+        explicit DurableAVLTree(std::string path, AVLDurability options = {})
+            : _tree{}, path{std::move(path)}, options{options}, log{-1}, log_bytes{0}, pending{}, pending_records{0}, failed{false} {
+            load_snapshot();
+            open_log();
+        }
+
+        DurableAVLTree(const DurableAVLTree&) = delete;
+        DurableAVLTree& operator=(const DurableAVLTree&) = delete;
+
+        ~DurableAVLTree() {
+            try {
+                commit();
+            } catch (...) {} // nothing to report to from a destructor, the records after the last commit are lost
+            ::close(log);
+        }
+
+        // lookup
+        const AVLTree<Comparable>& tree() const noexcept { return _tree; }
+        bool contains(const Comparable& value) const { return _tree.contains(value); }
+        size_t size() const noexcept { return _tree.size(); }
+        bool is_empty() const noexcept { return _tree.is_empty(); }
+        typename AVLTree<Comparable>::const_iterator begin() const noexcept { return _tree.begin(); }
+        typename AVLTree<Comparable>::const_iterator end() const noexcept { return _tree.end(); }
+
+        // modifiers, durable once committed (every group_size records or by commit)
+        void insert(const Comparable& value) {
+            const size_t before = _tree.size();
+            _tree.insert(value);
+            if (_tree.size() != before) append(insert_op, value);
+        }
+
+        void remove(const Comparable& value) {
+            const size_t before = _tree.size();
+            _tree.remove(value);
+            if (_tree.size() != before) append(remove_op, value);
+        }
+
+        // writes the buffered records and waits for them to reach the disk
+        // on failure the records stay buffered and the log is cut back to the last commit, so
+        // a later commit doesn't land behind a torn record that replay would stop at
+        void commit() {
+            if (pending.empty()) return;
+            if (failed) throw std::runtime_error("Can't write " + path + ".log after a failed commit");
+            try {
+                write_all(log, pending.data(), pending.size(), path + ".log");
+                if (::fsync(log) != 0) fail("Can't sync " + path + ".log");
+            } catch (...) {
+                if (::ftruncate(log, static_cast<off_t>(log_bytes)) != 0 ||
+                    ::lseek(log, static_cast<off_t>(log_bytes), SEEK_SET) < 0) failed = true;
+                throw;
+            }
+            log_bytes += pending.size();
+            pending.clear();
+            pending_records = 0;
+        }
+
+        // writes the whole tree to a new snapshot and empties the log
+        // a crash before the log is emptied replays it onto the new snapshot, which changes nothing
+        // since every record is an insert or remove of a single value
+        void snapshot() {
+            commit();
+
+            std::string bytes = header(snapshot_magic);
+            AVLCodec<uint64_t>::encode(static_cast<uint64_t>(_tree.size()), bytes);
+            for (const Comparable& value : _tree) Codec::encode(value, bytes);
+            const uint32_t crc = avl_crc32(bytes.data(), bytes.size());
+            AVLCodec<uint32_t>::encode(crc, bytes);
+
+            const std::string name = path + ".snapshot";
+            const std::string temporary = name + ".tmp";
+            const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) fail("Can't open " + temporary);
+            try {
+                write_all(fd, bytes.data(), bytes.size(), temporary);
+                if (::fsync(fd) != 0) fail("Can't sync " + temporary);
+            } catch (...) {
+                ::close(fd);
+                throw;
+            }
+            ::close(fd);
+            if (::rename(temporary.c_str(), name.c_str()) != 0) fail("Can't replace " + name);
+            sync_directory();
+
+            if (::ftruncate(log, static_cast<off_t>(header_size)) != 0) fail("Can't truncate " + path + ".log");
+            if (::lseek(log, static_cast<off_t>(header_size), SEEK_SET) < 0) fail("Can't seek " + path + ".log");
+            if (::fsync(log) != 0) fail("Can't sync " + path + ".log");
+            log_bytes = header_size;
+        }
+
+        // bytes in the log, waiting to be folded into the next snapshot
+        size_t log_size() const noexcept { return log_bytes + pending.size(); }
+};
@@ -0,0 +1,236 @@
+/*
+ *  Set of integers stored as delta blocks in an AVL tree
+ *  Nearby keys share a block holding one full key (the base) and up to 256 sorted
+ *  16 bit offsets from it, so a dense or clustered set costs about 2 bytes per key
+ *  instead of a whole AVLTree node. The blocks are ordered by base in an AVLTree and
+ *  searched inside with SSE2 where available.
+*/
+
+#pragma once
+
+#include "avl.h"
+#include <vector>
+#include <cstdint> // uint16_t
+#include <type_traits> // std::is_integral, std::make_unsigned
+#include <limits> // std::numeric_limits
+#include <algorithm> // std::lower_bound
+#if defined(__SSE2__)
+#include <emmintrin.h> // block search
+#endif
+
+template <typename Integer>
+class DenseAVLSet {
+    static_assert(std::is_integral_v<Integer>, "DenseAVLSet holds integral keys");
+
+    private:
+        using Unsigned = std::make_unsigned_t<Integer>;
+        static constexpr size_t block_capacity = 256;
+        // the offsets are 16 bit, narrower keys can't be further apart than their own range
+        static constexpr Unsigned max_offset = std::numeric_limits<Unsigned>::max() < 0xffff ? std::numeric_limits<Unsigned>::max() : Unsigned(0xffff);
+
+        // keys base + offsets[i], every offset is less than the distance to the next block's base
+        // offsets don't take part in the ordering, so they can change in place inside the tree
+        struct Block {
+            Integer base;
+            mutable std::vector<uint16_t> offsets;
+
+            bool operator<(const Block& rhs) const { return base < rhs.base; }
+            bool operator>(const Block& rhs) const { return rhs.base < base; }
+            bool operator==(const Block& rhs) const { return base == rhs.base; }
+        };
+
+        using block_iterator = typename AVLTree<Block>::const_iterator;
+
+        AVLTree<Block> blocks;
+        size_t _size;
+
+        static Unsigned distance(Integer from, Integer to) { return Unsigned(to) - Unsigned(from); }
+
+        // number of offsets less than target, the index target has or would have in the block
+        static size_t position(const std::vector<uint16_t>& offsets, uint16_t target) {
+#if defined(__SSE2__)
+            // SSE2 only compares signed 16 bit lanes, flipping the top bit keeps the unsigned order
+            const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+            const __m128i key = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(target)), bias);
+            const uint16_t* data = offsets.data();
+            const size_t n = offsets.size();
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                const __m128i lanes = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), bias);
+                const int less = _mm_movemask_epi8(_mm_cmplt_epi16(lanes, key));
+                // the offsets are sorted, so the lanes less than target are a prefix
+                if (less != 0xffff) return i + __builtin_popcount(less) / 2;
+            }
+            while (i < n && data[i] < target) i++;
+            return i;
+#else
+            return std::lower_bound(offsets.begin(), offsets.end(), target) - offsets.begin();
+#endif
+        }
+
+        // the block whose range holds key: the last block with base <= key, or end()
+        block_iterator block_for(Integer key) const {
+            block_iterator it = blocks.upper_bound(Block{key, {}});
+            if (it == blocks.begin()) return blocks.end();
+            return --it;
+        }
+
+        // moves the upper half of a full block into a new block
+        void split(block_iterator it) {
+            std::vector<uint16_t>& offsets = it->offsets;
+            const size_t half = offsets.size() / 2;
+            const uint16_t first = offsets[half];
+
+            Block upper{static_cast<Integer>(Unsigned(it->base) + first), {}};
+            upper.offsets.reserve(block_capacity);
+            for (size_t i = half; i < offsets.size(); i++) upper.offsets.push_back(offsets[i] - first);
+            offsets.resize(half);
+            blocks.insert(upper);
+        }
+
+    public:
+        class iterator;
+        using const_iterator = iterator;
+
+        DenseAVLSet() : blocks{}, _size{0} {}
+
+        // lookup
+        bool contains(Integer key) const {
+            block_iterator it = block_for(key);
+            if (it == blocks.end()) return false;
+
+            const Unsigned offset = distance(it->base, key);
+            if (offset > max_offset) return false;
+            const size_t i = position(it->offsets, static_cast<uint16_t>(offset));
+            return i < it->offsets.size() && it->offsets[i] == offset;
+        }
+
+        Integer find_min() const {
+            if (is_empty()) throw std::invalid_argument("Tree is empty.");
+            const Block& block = blocks.find_min();
+            return static_cast<Integer>(Unsigned(block.base) + block.offsets.front());
+        }
+
+        Integer find_max() const {
+            if (is_empty()) throw std::invalid_argument("Tree is empty.");
+            const Block& block = blocks.find_max();
+            return static_cast<Integer>(Unsigned(block.base) + block.offsets.back());
+        }
+
+        // modifiers
+        void insert(Integer key) {
+            block_iterator it = block_for(key);
+
+            if (it == blocks.end()) {
+                // below every block: move the first block's base down if its offsets still fit
+                block_iterator first = blocks.begin();
+                if (first != blocks.end() && first->offsets.size() < block_capacity &&
+                    distance(key, first->base) + first->offsets.back() <= max_offset) {
+                    const uint16_t shift = static_cast<uint16_t>(distance(key, first->base));
+                    auto handle = blocks.extract(first);
+                    Block& block = handle.value();
+                    for (uint16_t& offset : block.offsets) offset += shift;
+                    block.offsets.insert(block.offsets.begin(), 0);
+                    block.base = key;
+                    blocks.insert(std::move(handle));
+                }
+                else blocks.insert(Block{key, {0}});
+                _size++;
+                return;
+            }
+
+            const Unsigned offset = distance(it->base, key);
+            if (offset > max_offset) {
+                blocks.insert(Block{key, {0}});
+                _size++;
+                return;
+            }
+
+            std::vector<uint16_t>& offsets = it->offsets;
+            const size_t i = position(offsets, static_cast<uint16_t>(offset));
+            if (i < offsets.size() && offsets[i] == offset) return;
+
+            offsets.insert(offsets.begin() + i, static_cast<uint16_t>(offset));
+            _size++;
+            if (offsets.size() > block_capacity) split(it);
+        }
+
+        void remove(Integer key) {
+            block_iterator it = block_for(key);
+            if (it == blocks.end()) return;
+
+            const Unsigned offset = distance(it->base, key);
+            if (offset > max_offset) return;
+            std::vector<uint16_t>& offsets = it->offsets;
+            const size_t i = position(offsets, static_cast<uint16_t>(offset));
+            if (i == offsets.size() || offsets[i] != offset) return;
+
+            offsets.erase(offsets.begin() + i);
+            _size--;
+            if (offsets.empty()) blocks.remove(*it);
+        }
+
+        void clear() {
+            blocks.clear();
+            _size = 0;
+        }
+
+        // capacity
+        size_t size() const noexcept { return _size; }
+        bool is_empty() const noexcept { return _size == 0; }
+        size_t block_count() const noexcept { return blocks.size(); }
+
+        // tree nodes plus the offset arrays
+        size_t bytes_used() const {
+            size_t bytes = blocks.bytes_used();
+            for (const Block& block : blocks) bytes += block.offsets.capacity() * sizeof(uint16_t);
+            return bytes;
+        }
+
+        // iteration, any insert or remove invalidates iterators
+        iterator begin() const { return iterator(blocks.begin(), 0); }
+        iterator end() const { return iterator(blocks.end(), 0); }
+
+        class iterator {
+            public:
+                using iterator_category = std::bidirectional_iterator_tag;
+                using value_type        = Integer;
+                using difference_type   = std::ptrdiff_t;
+                using pointer           = void;
+                using reference         = Integer; // keys are decoded on the fly
+
+            private:
+                block_iterator block;
+                size_t index;
+
+            public:
+                iterator() : block{}, index{0} {}
+                iterator(block_iterator block, size_t index) : block{block}, index{index} {}
+
+                reference operator*() const { return static_cast<Integer>(Unsigned(block->base) + block->offsets[index]); }
+
+                iterator& operator++() {
+                    if (++index == block->offsets.size()) {
+                        ++block;
+                        index = 0;
+                    }
+                    return *this;
+                }
+
+                iterator operator++(int) { iterator copy = *this; ++(*this); return copy; }
+
+                iterator& operator--() {
+                    if (index == 0) {
+                        --block;
+                        index = block->offsets.size();
+                    }
+                    index--;
+                    return *this;
+                }
+
+                iterator operator--(int) { iterator copy = *this; --(*this); return copy; }
+
+                bool operator==(const iterator& rhs) const { return block == rhs.block && index == rhs.index; }
+                bool operator!=(const iterator& rhs) const { return !(*this == rhs); }
+        };
+};
@@ -0,0 +1,100 @@
+/*
+ *  Interval tree built on the AVL tree
+ *  Every node also stores the largest end point in its subtree, which is kept
+ *  up to date through rotations by AVLAugment, so overlap queries can skip
+ *  subtrees that end too early.
+*/
+
+#pragma once
+
+#include "avl.h"
+#include <vector> // stabbing results
+#include <iterator> // std::back_inserter
+
+// half open interval [lo, hi), ordered by lo then hi
+template <typename T>
+struct Interval {
+    T lo;
+    T hi;
+
+    bool operator<(const Interval& rhs) const { return lo < rhs.lo || (!(rhs.lo < lo) && hi < rhs.hi); }
+    bool operator>(const Interval& rhs) const { return rhs < *this; }
+    bool operator<=(const Interval& rhs) const { return !(rhs < *this); }
+    bool operator>=(const Interval& rhs) const { return !(*this < rhs); }
+    bool operator==(const Interval& rhs) const { return !(*this < rhs) && !(rhs < *this); }
+    bool operator!=(const Interval& rhs) const { return !(*this == rhs); }
+};
+
+template <typename T>
+std::ostream& operator<<(std::ostream& os, const Interval<T>& interval) {
+    return os << "[" << interval.lo << ", " << interval.hi << ")";
+}
+
+template <typename T>
+struct AVLAugment<Interval<T>> {
+    struct data {
+        T max_hi{}; // largest hi in the subtree
+    };
+
+    template <typename Node>
+    static void update(Node* node) {
+        node->max_hi = node->value.hi;
+        if (node->left && node->max_hi < node->left->max_hi) node->max_hi = node->left->max_hi;
+        if (node->right && node->max_hi < node->right->max_hi) node->max_hi = node->right->max_hi;
+    }
+};
+
+template <typename T>
+class IntervalTree : public AVLTree<Interval<T>> {
+    private:
+        using AVLNode = typename AVLTree<Interval<T>>::AVLNode;
+
+        template <typename OutputIt>
+        void find_overlapping(const T& lo, const T& hi, const AVLNode* root, OutputIt& out) const {
+            // nothing in this subtree ends after lo
+            if (!root || !(lo < root->max_hi)) return;
+
+            find_overlapping(lo, hi, root->left, out);
+            // everything to the right starts at or after root, so it can only overlap if root starts before hi
+            if (root->value.lo < hi) {
+                if (lo < root->value.hi) *out++ = root->value;
+                find_overlapping(lo, hi, root->right, out);
+            }
+        }
+
+        template <typename OutputIt>
+        void stabbing(const T& point, const AVLNode* root, OutputIt& out) const {
+            if (!root || !(point < root->max_hi)) return;
+
+            stabbing(point, root->left, out);
+            if (!(point < root->value.lo)) {
+                if (point < root->value.hi) *out++ = root->value;
+                stabbing(point, root->right, out);
+            }
+        }
+
+    public:
+        using AVLTree<Interval<T>>::insert;
+        using AVLTree<Interval<T>>::remove;
+        using AVLTree<Interval<T>>::contains;
+
+        void insert(const T& lo, const T& hi) { insert(Interval<T>{lo, hi}); }
+        void remove(const T& lo, const T& hi) { remove(Interval<T>{lo, hi}); }
+        bool contains(const T& lo, const T& hi) const { return contains(Interval<T>{lo, hi}); }
+
+        // writes every stored interval overlapping [lo, hi) to out in sorted order
+        // O(log n) per reported interval instead of a scan over the whole tree
+        template <typename OutputIt>
+        OutputIt find_overlapping(const T& lo, const T& hi, OutputIt out) const {
+            find_overlapping(lo, hi, this->root, out);
+            return out;
+        }
+
+        // every stored interval containing point, in sorted order
+        std::vector<Interval<T>> stabbing(const T& point) const {
+            std::vector<Interval<T>> result;
+            auto out = std::back_inserter(result);
+            stabbing(point, this->root, out);
+            return result;
+        }
+};
@@ -0,0 +1,242 @@
+/*
+ *  Sharded set built from independent AVL trees
+ *  The key space is split across shards (by hash or by key range) so threads
+ *  working on different shards never contend on the same root or lock.
+*/
+
+#pragma once
+
+#include "avl.h"
+#include <vector>
+#include <memory> // std::unique_ptr
+#include <mutex> // std::unique_lock
+#include <shared_mutex> // std::shared_mutex, std::shared_lock
+#include <thread> // parallel clear / bulk load
+#include <atomic> // total size
+#include <queue> // k-way merge
+#include <algorithm> // std::sort, std::upper_bound
+#include <functional> // std::hash
+
+template <typename Comparable, typename Hash = std::hash<Comparable>>
+class ShardedAVLSet {
+    public:
+        enum class partition { hash, range };
+
+    private:
+        struct Shard {
+            mutable std::shared_mutex lock;
+            AVLTree<Comparable> tree;
+            std::atomic<size_t> count; // tree.size(), readable without the lock
+
+            Shard() : lock{}, tree{}, count{0} {}
+        };
+
+        partition _partition;
+        bool fixed; // range bounds given by the caller, never moved
+        std::vector<std::unique_ptr<Shard>> shards;
+        // range partitioning: shard i holds values in [bounds[i - 1], bounds[i])
+        std::vector<Comparable> bounds;
+        // held shared by every operation, exclusively while resharding moves values between shards
+        mutable std::shared_mutex layout;
+        std::atomic<size_t> _size;
+        Hash hasher;
+
+        size_t shard_for(const Comparable& value) const {
+            if (_partition == partition::hash) return hasher(value) % shards.size();
+            return std::upper_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+        }
+
+        // a range shard holding more than twice its share of the values
+        bool unbalanced(size_t shard_size) const {
+            if (_partition != partition::range || fixed || shards.size() < 2) return false;
+            return shard_size > 2 * (_size / shards.size()) + 64;
+        }
+
+        // moves nodes between neighbouring shards until every shard holds about total / n values
+        // and moves the bounds to match; the caller holds layout exclusively
+        void reshard() {
+            const size_t n = shards.size();
+            size_t total = 0;
+            for (const auto& shard : shards) total += shard->tree.size();
+            if (total < n) return;
+
+            for (size_t i = 0; i + 1 < n; i++) {
+                const size_t target = total / n + (i < total % n ? 1 : 0);
+                AVLTree<Comparable>& here = shards[i]->tree;
+                AVLTree<Comparable>& next = shards[i + 1]->tree;
+
+                // node handles move values without allocating or copying
+                while (here.size() > target) next.insert(here.extract(here.find_max()));
+                while (here.size() < target) {
+                    // the first non empty shard to the right holds the next values in order
+                    size_t j = i + 1;
+                    while (shards[j]->tree.is_empty()) j++;
+                    here.insert(shards[j]->tree.extract(shards[j]->tree.find_min()));
+                }
+            }
+
+            // every shard holds at least one value now
+            for (size_t i = 0; i + 1 < n; i++) bounds[i] = shards[i + 1]->tree.find_min();
+            for (const auto& shard : shards) shard->count = shard->tree.size();
+        }
+
+        // a remove shrinks every shard's share, so any shard can end up over it
+        bool any_unbalanced() const {
+            for (const auto& shard : shards) {
+                if (unbalanced(shard->count)) return true;
+            }
+            return false;
+        }
+
+        void maybe_reshard() {
+            std::unique_lock<std::shared_mutex> exclusive(layout);
+            if (any_unbalanced()) reshard();
+        }
+
+        // runs f(shard index) on one thread per shard
+        template <typename F>
+        void parallel(F f) const {
+            std::vector<std::thread> workers;
+            workers.reserve(shards.size());
+            for (size_t i = 0; i < shards.size(); i++) workers.emplace_back(f, i);
+            for (std::thread& worker : workers) worker.join();
+        }
+
+    public:
+        explicit ShardedAVLSet(size_t shard_count, partition how = partition::hash)
+            : _partition{how}, fixed{false}, shards{}, bounds{}, layout{}, _size{0}, hasher{} {
+            if (shard_count == 0) throw std::invalid_argument("A sharded set needs at least one shard");
+            for (size_t i = 0; i < shard_count; i++) shards.push_back(std::make_unique<Shard>());
+            // until values arrive every range shard but the last is empty, the first reshard picks real bounds
+            if (_partition == partition::range) bounds.assign(shard_count - 1, Comparable{});
+        }
+
+        // range partitioning with fixed split points, shard i holds [split_points[i - 1], split_points[i])
+        // however uneven the shards get
+        explicit ShardedAVLSet(std::vector<Comparable> split_points)
+            : _partition{partition::range}, fixed{true}, shards{}, bounds{std::move(split_points)}, layout{}, _size{0}, hasher{} {
+            std::sort(bounds.begin(), bounds.end());
+            for (size_t i = 0; i <= bounds.size(); i++) shards.push_back(std::make_unique<Shard>());
+        }
+
+        ShardedAVLSet(const ShardedAVLSet&) = delete;
+        ShardedAVLSet& operator=(const ShardedAVLSet&) = delete;
+
+        // lookup
+        bool contains(const Comparable& value) const {
+            std::shared_lock<std::shared_mutex> shared(layout);
+            const Shard& shard = *shards[shard_for(value)];
+            std::shared_lock<std::shared_mutex> reader(shard.lock);
+            return shard.tree.contains(value);
+        }
+
+        // modifiers
+        void insert(const Comparable& value) {
+            bool reshard_needed;
+            {
+                std::shared_lock<std::shared_mutex> shared(layout);
+                Shard& shard = *shards[shard_for(value)];
+                std::unique_lock<std::shared_mutex> writer(shard.lock);
+                const size_t before = shard.tree.size();
+                shard.tree.insert(value);
+                if (shard.tree.size() != before) _size++;
+                shard.count = shard.tree.size();
+                reshard_needed = unbalanced(shard.tree.size());
+            }
+            if (reshard_needed) maybe_reshard();
+        }
+
+        void remove(const Comparable& value) {
+            bool reshard_needed = false;
+            {
+                std::shared_lock<std::shared_mutex> shared(layout);
+                Shard& shard = *shards[shard_for(value)];
+                std::unique_lock<std::shared_mutex> writer(shard.lock);
+                const size_t before = shard.tree.size();
+                shard.tree.remove(value);
+                if (shard.tree.size() != before) {
+                    _size--;
+                    shard.count = shard.tree.size();
+                    reshard_needed = any_unbalanced();
+                }
+            }
+            if (reshard_needed) maybe_reshard();
+        }
+
+        // inserts every value in [first, last), building each shard on its own thread
+        template <typename InputIt>
+        void bulk_load(InputIt first, InputIt last) {
+            std::vector<Comparable> values(first, last);
+            std::sort(values.begin(), values.end());
+
+            std::unique_lock<std::shared_mutex> exclusive(layout);
+            // an empty range set takes its bounds from the data, unless they were given
+            if (_partition == partition::range && !fixed && _size == 0 && !values.empty()) {
+                for (size_t i = 0; i < bounds.size(); i++) bounds[i] = values[(i + 1) * values.size() / shards.size()];
+            }
+
+            std::vector<std::vector<Comparable>> parts(shards.size());
+            for (const Comparable& value : values) parts[shard_for(value)].push_back(value);
+
+            std::atomic<size_t> added{0};
+            parallel([&](size_t i) {
+                AVLTree<Comparable>& tree = shards[i]->tree;
+                const size_t before = tree.size();
+                // sorted input mostly lands past the max, so append_max skips the search from the root
+                for (const Comparable& value : parts[i]) tree.append_max(value);
+                added += tree.size() - before;
+                shards[i]->count = tree.size();
+            });
+            _size += added;
+
+            if (any_unbalanced()) reshard();
+        }
+
+        // capacity
+        size_t size() const noexcept { return _size; }
+        bool is_empty() const noexcept { return _size == 0; }
+        size_t shard_count() const noexcept { return shards.size(); }
+
+        std::vector<size_t> shard_sizes() const {
+            std::shared_lock<std::shared_mutex> shared(layout);
+            std::vector<size_t> sizes;
+            for (const auto& shard : shards) {
+                std::shared_lock<std::shared_mutex> reader(shard->lock);
+                sizes.push_back(shard->tree.size());
+            }
+            return sizes;
+        }
+
+        // clears every shard on its own thread
+        void clear() {
+            std::unique_lock<std::shared_mutex> exclusive(layout);
+            parallel([this](size_t i) {
+                shards[i]->tree.clear();
+                shards[i]->count = 0;
+            });
+            _size = 0;
+        }
+
+        // calls f on every value in sorted order, merging the shards with a k-way merge
+        // writers are blocked for the duration of the call
+        template <typename F>
+        void for_each(F f) const {
+            std::shared_lock<std::shared_mutex> shared(layout);
+            std::vector<std::shared_lock<std::shared_mutex>> readers;
+            for (const auto& shard : shards) readers.emplace_back(shard->lock);
+
+            using cursor = std::pair<typename AVLTree<Comparable>::const_iterator, typename AVLTree<Comparable>::const_iterator>;
+            auto later = [](const cursor& a, const cursor& b) { return *b.first < *a.first; };
+            std::priority_queue<cursor, std::vector<cursor>, decltype(later)> heap(later);
+            for (const auto& shard : shards) {
+                if (!shard->tree.is_empty()) heap.push({shard->tree.begin(), shard->tree.end()});
+            }
+
+            while (!heap.empty()) {
+                cursor next = heap.top();
+                heap.pop();
+                f(*next.first);
+                if (++next.first != next.second) heap.push(next);
+            }
+        }
+};
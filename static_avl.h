@@ -0,0 +1,217 @@
+/*
+ *  Fixed capacity AVL tree usable in constant expressions
+ *  Nodes live in an array and link to each other by index, so nothing is allocated and a
+ *  tree built in a constexpr context ends up in read-only data, e.g.
+ *
+ *      constexpr auto opcodes = [] {
+ *          StaticAVLTree<int, 8> tree;
+ *          for (int op : {0x10, 0x20, 0x31}) tree.insert(op);
+ *          return tree;
+ *      }();
+ *      static_assert(opcodes.contains(0x20));
+*/
+
+#pragma once
+
+#include <cstddef> // size_t, ptrdiff_t
+#include <iterator> // std::bidirectional_iterator_tag
+#include <stdexcept> // std::invalid_argument, std::length_error
+
+template <typename Comparable, size_t Capacity>
+class StaticAVLTree {
+    private:
+        static constexpr int none = -1;
+
+        struct StaticAVLNode {
+            Comparable value{};
+            int left = none;
+            int right = none;
+            int height = 1;
+            int parent = none; // for iterator
+        };
+
+        StaticAVLNode nodes[Capacity]{};
+        int root = none;
+        size_t _size = 0;
+        int min = none; // for O(1) iterator creation on begin
+        int max = none;
+
+        constexpr int height(int node) const { return node == none ? 0 : nodes[node].height; }
+
+        constexpr void update(int node) {
+            int left = height(nodes[node].left);
+            int right = height(nodes[node].right);
+            nodes[node].height = (left > right ? left : right) + 1;
+        }
+
+        // methods for rebalancing, the same rotations as AVLTree with indices for pointers
+        constexpr void single_left_rotation(int& root) {
+            int right_child = nodes[root].right;
+            nodes[right_child].parent = nodes[root].parent;
+            nodes[root].parent = right_child;
+            if (nodes[right_child].left != none) nodes[nodes[right_child].left].parent = root;
+
+            nodes[root].right = nodes[right_child].left;
+            nodes[right_child].left = root;
+
+            update(root);
+            update(right_child);
+            root = right_child;
+        }
+
+        constexpr void single_right_rotation(int& root) {
+            int left_child = nodes[root].left;
+            nodes[left_child].parent = nodes[root].parent;
+            nodes[root].parent = left_child;
+            if (nodes[left_child].right != none) nodes[nodes[left_child].right].parent = root;
+
+            nodes[root].left = nodes[left_child].right;
+            nodes[left_child].right = root;
+
+            update(root);
+            update(left_child);
+            root = left_child;
+        }
+
+        constexpr void rebalance(int& root) {
+            const StaticAVLNode& node = nodes[root];
+            if (height(node.left) - height(node.right) > 1) {
+                if (height(nodes[node.left].left) < height(nodes[node.left].right))
+                    single_left_rotation(nodes[root].left);
+                single_right_rotation(root);
+            }
+            else if (height(node.right) - height(node.left) > 1) {
+                if (height(nodes[node.right].right) < height(nodes[node.right].left))
+                    single_right_rotation(nodes[root].right);
+                single_left_rotation(root);
+            }
+
+            update(root);
+        }
+
+        constexpr void insert(const Comparable& value, int& root, int parent) {
+            if (root == none) {
+                if (_size == Capacity) throw std::length_error("The tree is full");
+
+                root = static_cast<int>(_size++);
+                nodes[root].value = value;
+                nodes[root].parent = parent;
+
+                if (min == none || value < nodes[min].value) min = root;
+                if (max == none || nodes[max].value < value) max = root;
+                return;
+            }
+
+            if (value < nodes[root].value) insert(value, nodes[root].left, root);
+            else if (nodes[root].value < value) insert(value, nodes[root].right, root);
+            else return;
+
+            rebalance(root);
+        }
+
+    public:
+        class iterator;
+        using const_iterator = iterator;
+
+        constexpr StaticAVLTree() = default;
+
+        // lookup
+        constexpr bool contains(const Comparable& value) const {
+            int node = root;
+            while (node != none) {
+                if (value < nodes[node].value) node = nodes[node].left;
+                else if (nodes[node].value < value) node = nodes[node].right;
+                else return true;
+            }
+            return false;
+        }
+
+        constexpr const Comparable& find_min() const {
+            if (min == none) throw std::invalid_argument("The tree is empty");
+            return nodes[min].value;
+        }
+
+        constexpr const Comparable& find_max() const {
+            if (max == none) throw std::invalid_argument("The tree is empty");
+            return nodes[max].value;
+        }
+
+        // modifiers
+        constexpr void insert(const Comparable& value) { insert(value, root, none); }
+
+        // capacity
+        constexpr size_t size() const noexcept { return _size; }
+        constexpr bool is_empty() const noexcept { return root == none; }
+        static constexpr size_t capacity() noexcept { return Capacity; }
+
+        // iteration
+        constexpr iterator begin() const noexcept { return iterator(this, min); }
+        constexpr iterator end() const noexcept { return iterator(this, none); }
+
+        class iterator {
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type        = Comparable;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = const Comparable*;
+            using reference         = const Comparable&;
+        private:
+            const StaticAVLTree* tree = nullptr;
+            int node = none;
+
+        public:
+            constexpr iterator() = default;
+            constexpr iterator(const StaticAVLTree* tree, int node) : tree{tree}, node{node} {}
+
+            [[nodiscard]] constexpr reference operator*() const noexcept { return tree->nodes[node].value; }
+            [[nodiscard]] constexpr pointer operator->() const noexcept { return &tree->nodes[node].value; }
+
+            constexpr iterator& operator++() noexcept {
+                if (node == none) return *this;
+
+                const StaticAVLNode* nodes = tree->nodes;
+                if (nodes[node].right != none) {
+                    node = nodes[node].right;
+                    while (nodes[node].left != none) node = nodes[node].left;
+                }
+                else {
+                    int parent = nodes[node].parent;
+                    while (parent != none && node == nodes[parent].right) {
+                        node = parent;
+                        parent = nodes[parent].parent;
+                    }
+                    node = parent;
+                }
+                return *this;
+            }
+
+            constexpr iterator operator++(int) noexcept { iterator copy = *this; ++(*this); return copy; }
+
+            constexpr iterator& operator--() noexcept {
+                if (node == none) {
+                    node = tree->max;
+                    return *this;
+                }
+
+                const StaticAVLNode* nodes = tree->nodes;
+                if (nodes[node].left != none) {
+                    node = nodes[node].left;
+                    while (nodes[node].right != none) node = nodes[node].right;
+                }
+                else {
+                    int parent = nodes[node].parent;
+                    while (parent != none && node == nodes[parent].left) {
+                        node = parent;
+                        parent = nodes[parent].parent;
+                    }
+                    node = parent;
+                }
+                return *this;
+            }
+
+            constexpr iterator operator--(int) noexcept { iterator copy = *this; --(*this); return copy; }
+
+            [[nodiscard]] constexpr bool operator==(const iterator& rhs) const noexcept { return node == rhs.node; }
+            [[nodiscard]] constexpr bool operator!=(const iterator& rhs) const noexcept { return node != rhs.node; }
+        };
+};